@@ -0,0 +1,240 @@
+//-----------------------------------------------------------------------------
+// The analog inputs for ldpi. A READ ADC instruction in the ladder mustn't
+// wait for a conversion, which over SPI means a system call and tens of
+// microseconds, so a sampling thread of its own reads the channels that the
+// ladders use, at a steady rate, into AdcValues[]; the instruction is then
+// one load from there, and always gets the latest reading, however slow or
+// stuck the converter is. Use it with
+//
+//      --adc=mcp3008[:/dev/spidev0.0][,speed=HZ][,rate=HZ]
+//      --adc=file:PATH[,rate=HZ]
+//
+// The first reads an MCP3008 (or MCP3004) on the Pi's SPI bus, at 1 MHz by
+// default: 10 bits, 0 to 1023. The second is for testing without one, and
+// reads the readings, as numbers separated by spaces (channel 0 first),
+// from a file, which can be in /dev/shm to share it between programs:
+//
+//      $ echo 512 100 1023 > /dev/shm/adc
+//
+// Either way the channels are sampled rate times a second (1000 by
+// default). A channel is named in the ladder by giving the READ ADC's
+// variable a name with ADCn in it, for n from 0 to 7 (LDmicro starts it
+// with an A anyway): ADC0, or Apot_ADC3. A reading that fails is counted,
+// and the channel keeps its last value.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "adc.h"
+
+#define ADC_MCP3008             1
+#define ADC_FILE                2
+
+SWORD AdcValues[ADC_CHANNELS];
+int Adc;
+unsigned long long AdcSamples, AdcErrors;
+
+static char Path[128];
+static int Fd = -1;
+static unsigned Speed = 1000000;
+static long long Period = 1000000;      // ns
+static BYTE Used[ADC_CHANNELS];
+static int UsedCount;
+static pthread_t Thread;
+static int Started;
+
+void AdcConfigure(const char *args)
+{
+    char buf[160], *p, *colon;
+
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+        if(strncmp(p, "rate=", 5) == 0) {
+            long rate = atol(p + 5);
+            if(rate <= 0 || rate > 100000) {
+                fprintf(stderr, "adc: rate must be 1 to 100000 Hz\n");
+                exit(-1);
+            }
+            Period = 1000000000LL / rate;
+        } else if(strncmp(p, "speed=", 6) == 0) {
+            Speed = atol(p + 6);
+        } else if(!Adc) {
+            if((colon = strchr(p, ':'))) *colon++ = '\0';
+            if(strcmp(p, "mcp3008") == 0) {
+                Adc = ADC_MCP3008;
+                snprintf(Path, sizeof(Path), "%s",
+                    colon ? colon : "/dev/spidev0.0");
+            } else if(strcmp(p, "file") == 0 && colon && *colon) {
+                Adc = ADC_FILE;
+                snprintf(Path, sizeof(Path), "%s", colon);
+            } else {
+                fprintf(stderr, "adc: '%s'? (mcp3008[:dev] or file:path)\n",
+                    p);
+                exit(-1);
+            }
+        }
+    }
+    if(!Adc) {
+        fprintf(stderr, "adc: which converter? (mcp3008 or file:path)\n");
+        exit(-1);
+    }
+}
+
+int AdcChannelOf(const char *name)
+{
+    const char *p;
+    int channel;
+
+    for(p = name; (p = strstr(p, "ADC")); p++) {
+        if(p[3] >= '0' && p[3] <= '9' &&
+            (channel = atoi(p + 3)) < ADC_CHANNELS)
+        {
+            return channel;
+        }
+    }
+    return -1;
+}
+
+void AdcUse(int channel)
+{
+    if(!Used[channel]) UsedCount++;
+    Used[channel] = 1;
+}
+
+//-----------------------------------------------------------------------------
+// The converters.
+//-----------------------------------------------------------------------------
+static int Mcp3008Read(int channel)
+{
+    // Start bit, then single-ended and the channel; the 10-bit result comes
+    // back in the last 10 bits of the three bytes.
+    BYTE tx[3] = { 0x01, 0x80 | (channel << 4), 0x00 }, rx[3];
+    struct spi_ioc_transfer xfer;
+
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (unsigned long)tx;
+    xfer.rx_buf = (unsigned long)rx;
+    xfer.len = sizeof(tx);
+    xfer.speed_hz = Speed;
+    xfer.bits_per_word = 8;
+    if(ioctl(Fd, SPI_IOC_MESSAGE(1), &xfer) < 0) return -1;
+    return ((rx[1] & 0x03) << 8) | rx[2];
+}
+
+static void SampleMcp3008(void)
+{
+    int channel, v;
+
+    for(channel = 0; channel < ADC_CHANNELS; channel++) {
+        if(!Used[channel]) continue;
+        if((v = Mcp3008Read(channel)) < 0) {
+            AdcErrors++;
+            continue;
+        }
+        __atomic_store_n(&AdcValues[channel], (SWORD)v, __ATOMIC_RELAXED);
+    }
+    AdcSamples++;
+}
+
+static void SampleFile(void)
+{
+    char buf[256], *p, *end;
+    int channel, n;
+    long v;
+
+    // A file that is being rewritten may be caught empty or half written;
+    // keep the last readings until it makes sense again.
+    if((n = pread(Fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+        AdcErrors++;
+        return;
+    }
+    buf[n] = '\0';
+    for(p = buf, channel = 0; channel < ADC_CHANNELS; channel++, p = end) {
+        v = strtol(p, &end, 0);
+        if(end == p) break;
+        if(Used[channel]) {
+            __atomic_store_n(&AdcValues[channel], (SWORD)v, __ATOMIC_RELAXED);
+        }
+    }
+    AdcSamples++;
+}
+
+static void *AdcThread(void *arg)
+{
+    struct timespec next, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while(Running) {
+        if(Adc == ADC_MCP3008) SampleMcp3008(); else SampleFile();
+
+        // If sampling falls behind, skip ahead rather than catch up.
+        TimespecAddNs(&next, Period);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(TimespecDiffNs(&now, &next) >= 0) {
+            next = now;
+            continue;
+        }
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+            == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+void AdcStart(void)
+{
+    pthread_attr_t attr;
+    BYTE mode = SPI_MODE_0;
+    int err;
+
+    if(!UsedCount) return;
+    if(!Adc) {
+        printf("the ladder reads ADC channels, but no --adc was given; they "
+            "read 0\n");
+        return;
+    }
+    if((Fd = open(Path, Adc == ADC_MCP3008 ? O_RDWR : O_RDONLY)) < 0) {
+        perror(Path);
+        exit(-1);
+    }
+    if(Adc == ADC_MCP3008 && (ioctl(Fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+        ioctl(Fd, SPI_IOC_WR_MAX_SPEED_HZ, &Speed) < 0))
+    {
+        perror(Path);
+        exit(-1);
+    }
+    printf("Sampling %d ADC channel(s) from %s %lld times a second\n",
+        UsedCount, Path, 1000000000LL / Period);
+
+    // Take one reading before the scans start, so that they never see the
+    // zeros that the channels start out as.
+    if(Adc == ADC_MCP3008) SampleMcp3008(); else SampleFile();
+
+    // The thread runs at an ordinary priority: the scans don't wait for it,
+    // and it mustn't take the CPU from them.
+    RtThreadAttr(&attr, 0, -1);
+    if((err = pthread_create(&Thread, &attr, AdcThread, NULL)) != 0) {
+        fprintf(stderr, "couldn't start ADC thread: %s\n", strerror(err));
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    Started = 1;
+}
+
+void AdcStop(void)
+{
+    if(!Started) return;
+    pthread_join(Thread, NULL);
+    close(Fd);
+    Started = 0;
+}
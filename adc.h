@@ -0,0 +1,30 @@
+//-----------------------------------------------------------------------------
+// The analog inputs for ldpi's READ ADC instructions; see adc.c.
+//-----------------------------------------------------------------------------
+#ifndef __ADC_H
+#define __ADC_H
+
+#include "ldpi.h"
+
+#define ADC_CHANNELS            8
+
+// The latest reading of each channel, kept up to date by the sampling
+// thread; READ ADC is just a load from here.
+extern SWORD AdcValues[ADC_CHANNELS];
+
+extern int Adc;                     // nonzero once --adc was given
+extern unsigned long long AdcSamples, AdcErrors;
+
+void AdcConfigure(const char *args);
+
+// The channel that an ADC variable reads, from an ADCn in its name, or -1.
+int AdcChannelOf(const char *name);
+
+// Note that a ladder reads the channel, so that the thread samples it.
+void AdcUse(int channel);
+
+// Start the sampling thread, and stop it at exit.
+void AdcStart(void);
+void AdcStop(void);
+
+#endif
@@ -0,0 +1,536 @@
+//-----------------------------------------------------------------------------
+// Writing and forcing the ladders' variables from outside: from the Modbus
+// server, and from a control socket (--control[=PATH], a UNIX socket at
+// /tmp/ldpi.sock by default) that takes lines like
+//
+//      get Tcnt                    Tcnt = 42
+//      write Tcnt 0                ok
+//      force XGPI3 1               ok
+//      forces                      force XGPI3 1 / ok
+//      unforce XGPI3               ok (or unforce all)
+//
+// where a name may be given as file:name to pick one of several programs.
+//
+// Each task has a bounded queue of commands, which any number of threads
+// can add to and only the task's scan thread takes from, at the start of
+// its scan, just after the image has been copied in. Adding takes no locks:
+// a producer claims its slots by moving the head along with a compare and
+// swap, and each slot has a sequence number that says whether it is free,
+// or filled and waiting for the scan. A batch of commands (a Modbus write
+// of several registers) is filled in last slot first, so the scan never
+// sees only part of one. If the queue is full the command is turned away;
+// the scan thread never waits for anyone.
+//
+// A forced variable is held at its value, whatever the ladder or a write
+// does, until it is unforced: the forces are applied after the image is
+// copied in and again after the logic has run. Forcing a pin also forces
+// it in the input image, for every task, or in the output image just before
+// it is written, by a mask over the image. The scan thread changes only its
+// own copy of the masks, and shows them to the I/O when it copies out its
+// outputs, under the lock that it takes for that anyway; so draining the
+// queue takes no locks either.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "image.h"
+#include "command.h"
+
+#define COMMAND_QUEUE           256     // per task; a power of two
+#define COMMAND_SOCKET          "/tmp/ldpi.sock"
+#define MAX_FORCES              64      // per task
+#define MAX_CONTROL_LINE        256
+
+const char *CommandSocket;
+unsigned long long CommandsApplied, CommandsRejected;
+
+typedef struct {
+    unsigned    seq;
+    Command     cmd;
+} Slot;
+
+typedef struct {
+    WORD        addr;
+    BYTE        isInt;
+    BYTE        output;     // if pin >= 0: an output pin rather than an input
+    int         pin;        // or -1
+    SWORD       value;
+} Force;
+
+typedef struct {
+    Slot        slots[COMMAND_QUEUE];
+    // Claimed by the producers, and taken by the scan thread; kept apart so
+    // that they don't share a cache line.
+    unsigned    head __attribute__((aligned(64)));
+    unsigned    tail __attribute__((aligned(64)));
+
+    // The scan thread's own.
+    Force       forces[MAX_FORCES];
+    int         forceCount;
+    IoWord      pinMask[2][IO_WORDS];   // as ForceMask, for this task
+    IoWord      pinValue[2][IO_WORDS];
+    int         pinsChanged;
+
+    // What CommandShowForces() last showed of pinMask and pinValue; under
+    // ImageLock.
+    IoWord      shownMask[2][IO_WORDS];
+    IoWord      shownValue[2][IO_WORDS];
+} Queue;
+
+static Queue Queues[MAX_TASKS];
+
+// The forced pins of all the tasks together, [0] for the inputs and [1] for
+// the outputs; under ImageLock.
+static IoWord ForceMask[2][IO_WORDS];
+static IoWord ForceValue[2][IO_WORDS];
+
+void CommandConfigure(const char *path)
+{
+    CommandSocket = path ? path : COMMAND_SOCKET;
+}
+
+void CommandInit(void)
+{
+    int i, k;
+
+    // Slot k is free for the command at position k (and k + COMMAND_QUEUE
+    // and so on, once the scan thread has been round).
+    for(i = 0; i < MAX_TASKS; i++) {
+        for(k = 0; k < COMMAND_QUEUE; k++) Queues[i].slots[k].seq = k;
+    }
+}
+
+int CommandPost(int task, const Command *cmd, int n)
+{
+    Queue *q = &Queues[task];
+    unsigned head, seq, last;
+    int i;
+
+    if(n < 1 || n > COMMAND_QUEUE) return 0;
+    head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    for(;;) {
+        // The scan thread frees the slots in order, so if the last one we
+        // need is free then so are the others.
+        last = head + n - 1;
+        seq = __atomic_load_n(&q->slots[last % COMMAND_QUEUE].seq,
+            __ATOMIC_ACQUIRE);
+        if((int)(seq - last) < 0) {
+            __atomic_fetch_add(&CommandsRejected, n, __ATOMIC_RELAXED);
+            return 0;
+        }
+        if(seq == last && __atomic_compare_exchange_n(&q->head, &head,
+            head + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+        // Another producer got there first; head has been reloaded.
+        if(seq != last) head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    }
+
+    // Last first, so that the scan thread stops at the first one until the
+    // whole batch is there.
+    for(i = n - 1; i >= 0; i--) {
+        Slot *s = &q->slots[(head + i) % COMMAND_QUEUE];
+        s->cmd = cmd[i];
+        __atomic_store_n(&s->seq, head + i + 1, __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// The scan thread's side.
+//-----------------------------------------------------------------------------
+static void ForcePin(Queue *q, const Force *f, int on)
+{
+    IO_SET(q->pinMask[f->output], f->pin, on);
+    IO_SET(q->pinValue[f->output], f->pin, on && f->value);
+    q->pinsChanged = 1;
+}
+
+static void Execute(Task *t, Queue *q, const Command *c)
+{
+    Force *f;
+    int i;
+
+    for(f = NULL, i = 0; i < q->forceCount; i++) {
+        if(q->forces[i].addr == c->addr && q->forces[i].isInt == c->isInt) {
+            f = &q->forces[i];
+            break;
+        }
+    }
+
+    switch(c->op) {
+        case CMD_WRITE:
+            if(c->isInt) {
+                t->integers[c->addr] = c->value;
+            } else {
+                t->bits[c->addr] = c->value ? 1 : 0;
+            }
+            break;
+
+        case CMD_FORCE:
+            if(!f) {
+                if(q->forceCount == MAX_FORCES) {
+                    __atomic_fetch_add(&CommandsRejected, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+                f = &q->forces[q->forceCount++];
+                f->addr = c->addr;
+                f->isInt = c->isInt;
+                f->pin = -1;
+                for(i = 0; !c->isInt && i < t->inputCount; i++) {
+                    if(t->inputs[i].addr == c->addr) {
+                        f->pin = t->inputs[i].pin;
+                        f->output = 0;
+                    }
+                }
+                for(i = 0; !c->isInt && i < t->outputCount; i++) {
+                    if(t->outputs[i].addr == c->addr) {
+                        f->pin = t->outputs[i].pin;
+                        f->output = 1;
+                    }
+                }
+            }
+            f->value = c->isInt ? c->value : (c->value ? 1 : 0);
+            if(f->pin >= 0) ForcePin(q, f, 1);
+            break;
+
+        case CMD_UNFORCE:
+            if(!f) break;
+            if(f->pin >= 0) ForcePin(q, f, 0);
+            *f = q->forces[--q->forceCount];
+            break;
+    }
+}
+
+void CommandApply(Task *t)
+{
+    Queue *q = &Queues[t - Tasks];
+    unsigned tail = q->tail, n = 0;
+    Slot *s;
+
+    for(;;) {
+        s = &q->slots[tail % COMMAND_QUEUE];
+        if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1) break;
+        Execute(t, q, &s->cmd);
+        __atomic_store_n(&s->seq, tail + COMMAND_QUEUE, __ATOMIC_RELEASE);
+        tail++;
+        n++;
+    }
+    if(n) {
+        q->tail = tail;
+        __atomic_fetch_add(&CommandsApplied, n, __ATOMIC_RELAXED);
+    }
+    CommandHold(t);
+}
+
+void CommandHold(Task *t)
+{
+    Queue *q = &Queues[t - Tasks];
+    int i;
+
+    for(i = 0; i < q->forceCount; i++) {
+        const Force *f = &q->forces[i];
+        if(f->isInt) {
+            t->integers[f->addr] = f->value;
+        } else {
+            t->bits[f->addr] = (BYTE)f->value;
+        }
+    }
+}
+
+void CommandShowForces(Task *t)
+{
+    Queue *q = &Queues[t - Tasks];
+    int i, k, w;
+
+    if(!q->pinsChanged) return;
+    memcpy(q->shownMask, q->pinMask, sizeof(q->shownMask));
+    memcpy(q->shownValue, q->pinValue, sizeof(q->shownValue));
+    q->pinsChanged = 0;
+
+    // Where two tasks force the same pin, the later task's value wins.
+    memset(ForceMask, 0, sizeof(ForceMask));
+    memset(ForceValue, 0, sizeof(ForceValue));
+    for(i = 0; i < NumTasks; i++) {
+        for(k = 0; k < 2; k++) {
+            for(w = 0; w < IO_WORDS; w++) {
+                IoWord m = Queues[i].shownMask[k][w];
+                ForceMask[k][w] |= m;
+                ForceValue[k][w] = (ForceValue[k][w] & ~m) |
+                    Queues[i].shownValue[k][w];
+            }
+        }
+    }
+}
+
+static void ForceImage(IoWord *image, int output)
+{
+    int w;
+
+    for(w = 0; w < IO_WORDS; w++) {
+        image[w] = (image[w] & ~ForceMask[output][w]) | ForceValue[output][w];
+    }
+}
+
+void CommandForceInputs(IoWord *image)
+{
+    ForceImage(image, 0);
+}
+
+void CommandForceOutputs(IoWord *image)
+{
+    ForceImage(image, 1);
+}
+
+//-----------------------------------------------------------------------------
+// The control socket. Its thread runs at ordinary priority, and only ever
+// reaches the scan threads through the queues and the process image.
+//-----------------------------------------------------------------------------
+typedef struct {
+    int         fd;
+    int         len;
+    char        line[MAX_CONTROL_LINE];
+} Client;
+
+// What we have forced, by symbol, so that 'forces' and 'unforce all' don't
+// have to ask the scan threads.
+static struct {
+    int         sym;
+    SWORD       value;
+} Forced[MAX_TASKS*MAX_FORCES];
+static int ForcedCount;
+static int ForcesOf[MAX_TASKS];     // of Forced[], how many each task has
+
+static int Listener = -1, Epoll = -1;
+static pthread_t Thread;
+
+// Returns -1 if the client isn't taking its replies.
+static int Reply(Client *c, const char *fmt, ...)
+{
+    char buf[MAX_CONTROL_LINE + 32];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if(n >= (int)sizeof(buf)) n = sizeof(buf) - 1;
+    return send(c->fd, buf, n, MSG_DONTWAIT | MSG_NOSIGNAL) == n ? 0 : -1;
+}
+
+static int Post(int sym, int op, int value)
+{
+    const LdpiImageSymbol *s = &Image->symbols[sym];
+    Command cmd;
+
+    cmd.op = op;
+    cmd.isInt = s->isInt;
+    cmd.addr = s->addr;
+    cmd.value = value;
+    return CommandPost(s->task, &cmd, 1);
+}
+
+static int Unforce(int k)
+{
+    if(!Post(Forced[k].sym, CMD_UNFORCE, 0)) return 0;
+    ForcesOf[Image->symbols[Forced[k].sym].task]--;
+    Forced[k] = Forced[--ForcedCount];
+    return 1;
+}
+
+static int Handle(Client *c, char *line)
+{
+    static LdpiImageTask snap;
+    char *op, *name, *arg, *end;
+    const LdpiImageSymbol *s;
+    long value = 0;
+    int sym = -1, k;
+
+    op = strtok(line, " \t\r");
+    name = strtok(NULL, " \t\r");
+    arg = strtok(NULL, " \t\r");
+    if(!op) return 0;
+
+    if(strcmp(op, "forces") == 0) {
+        for(k = 0; k < ForcedCount; k++) {
+            s = &Image->symbols[Forced[k].sym];
+            if(Reply(c, "force %s%s%s %d\n", NumTasks > 1 ?
+                Image->tasks[s->task].fileName : "", NumTasks > 1 ? ":" : "",
+                s->name, Forced[k].value) < 0)
+            {
+                return -1;
+            }
+        }
+        return Reply(c, "ok\n");
+    }
+    if(strcmp(op, "unforce") == 0 && name && strcmp(name, "all") == 0) {
+        while(ForcedCount > 0) {
+            if(!Unforce(ForcedCount - 1)) return Reply(c, "error: busy\n");
+        }
+        return Reply(c, "ok\n");
+    }
+
+    if(strcmp(op, "get") != 0 && strcmp(op, "write") != 0 &&
+        strcmp(op, "force") != 0 && strcmp(op, "unforce") != 0)
+    {
+        return Reply(c, "error: unknown command '%s'\n", op);
+    }
+    if(!name) return Reply(c, "error: %s what?\n", op);
+    if((sym = LdpiImageFind(Image, name)) < 0) {
+        return Reply(c, "error: no variable '%s'\n", name);
+    }
+    s = &Image->symbols[sym];
+    for(k = 0; k < ForcedCount && Forced[k].sym != sym; k++)
+        ;
+
+    if(strcmp(op, "get") == 0) {
+        if(LdpiImageRead(Image, s->task, &snap) < 0) {
+            return Reply(c, "error: busy\n");
+        }
+        return Reply(c, "%s = %d\n", name, LdpiImageValue(&snap, s));
+    }
+    if(strcmp(op, "unforce") == 0) {
+        if(k == ForcedCount) return Reply(c, "error: %s isn't forced\n", name);
+        return Reply(c, Unforce(k) ? "ok\n" : "error: busy\n");
+    }
+
+    if(arg) value = strtol(arg, &end, 0);
+    if(!arg || *end || value < -32768 || value > 32767) {
+        return Reply(c, "error: bad value\n");
+    }
+    if(!s->isInt) value = value ? 1 : 0;
+    if(strcmp(op, "write") == 0) {
+        return Reply(c, Post(sym, CMD_WRITE, value) ? "ok\n" : "error: busy\n");
+    }
+    // The scan keeps only MAX_FORCES for each task, and would drop more.
+    if(k == ForcedCount && ForcesOf[s->task] == MAX_FORCES) {
+        return Reply(c, "error: too many forces\n");
+    }
+    if(!Post(sym, CMD_FORCE, value)) return Reply(c, "error: busy\n");
+    if(k == ForcedCount) {
+        Forced[ForcedCount++].sym = sym;
+        ForcesOf[s->task]++;
+    }
+    Forced[k].value = value;
+    return Reply(c, "ok\n");
+}
+
+// Returns -1 once the client has gone, or should go.
+static int Service(Client *c)
+{
+    char *nl;
+    int n, off;
+
+    n = recv(c->fd, c->line + c->len, sizeof(c->line) - 1 - c->len, 0);
+    if(n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if(n == 0) return -1;
+    c->len += n;
+    c->line[c->len] = '\0';
+
+    off = 0;
+    while((nl = strchr(c->line + off, '\n'))) {
+        *nl = '\0';
+        if(Handle(c, c->line + off) < 0) return -1;
+        off = nl + 1 - c->line;
+    }
+    if(off == 0 && c->len == sizeof(c->line) - 1) {
+        Reply(c, "error: line too long\n");
+        return -1;
+    }
+    memmove(c->line, c->line + off, c->len - off);
+    c->len -= off;
+    return 0;
+}
+
+static void *ControlThread(void *arg)
+{
+    struct epoll_event ev[16], add;
+    Client *c;
+    int i, n, fd;
+
+    for(;;) {
+        n = epoll_wait(Epoll, ev, 16, -1);
+        for(i = 0; i < n; i++) {
+            if(ev[i].data.ptr != NULL) {
+                c = ev[i].data.ptr;
+                if((ev[i].events & (EPOLLERR | EPOLLHUP)) || Service(c) < 0) {
+                    close(c->fd);
+                    free(c);
+                }
+                continue;
+            }
+            while((fd = accept4(Listener, NULL, NULL,
+                SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+            {
+                if(!(c = calloc(1, sizeof(*c)))) {
+                    close(fd);
+                    continue;
+                }
+                c->fd = fd;
+                memset(&add, 0, sizeof(add));
+                add.events = EPOLLIN;
+                add.data.ptr = c;
+                if(epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &add) < 0) {
+                    close(fd);
+                    free(c);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+void CommandStart(void)
+{
+    struct sockaddr_un sa;
+    struct epoll_event ev;
+    pthread_attr_t attr;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if(strlen(CommandSocket) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "--control: path too long\n");
+        exit(-1);
+    }
+    strcpy(sa.sun_path, CommandSocket);
+    unlink(CommandSocket);
+
+    Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(Listener < 0 || bind(Listener, (struct sockaddr *)&sa, sizeof(sa)) < 0
+        || listen(Listener, 16) < 0)
+    {
+        perror(CommandSocket);
+        exit(-1);
+    }
+
+    Epoll = epoll_create1(EPOLL_CLOEXEC);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Listener, &ev);
+    printf("Control socket on %s\n", CommandSocket);
+
+    RtThreadAttr(&attr, 0, -1);
+    if(pthread_create(&Thread, &attr, ControlThread, NULL) != 0) {
+        perror("--control");
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void CommandStop(void)
+{
+    if(Listener >= 0) unlink(CommandSocket);
+}
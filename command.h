@@ -0,0 +1,54 @@
+//-----------------------------------------------------------------------------
+// Writing and forcing the ladders' variables from outside, without the scan
+// threads ever waiting for whoever is doing it; see command.c.
+//-----------------------------------------------------------------------------
+#ifndef __COMMAND_H
+#define __COMMAND_H
+
+#include "ldpi.h"
+
+#define CMD_WRITE               1   // set the variable, once
+#define CMD_FORCE               2   // hold it at value until unforced
+#define CMD_UNFORCE             3
+
+typedef struct {
+    BYTE        op;
+    BYTE        isInt;
+    WORD        addr;       // in the task's Bits[] or Integers[]
+    SWORD       value;
+} Command;
+
+// The control socket, if --control was given.
+extern const char *CommandSocket;
+extern unsigned long long CommandsApplied, CommandsRejected;
+
+void CommandConfigure(const char *path);
+
+// Set up the queues; before any of the scan threads start.
+void CommandInit(void);
+
+// Start the control socket's thread, and remove the socket at exit.
+void CommandStart(void);
+void CommandStop(void);
+
+// Queue n commands for task, to be carried out together at the start of
+// its next scan. From any thread; returns zero, having queued none of
+// them, if there isn't room.
+int CommandPost(int task, const Command *cmd, int n);
+
+// Called by each task's scan thread: carry out the commands queued for it,
+// after the image has been copied in, and apply its forces; then apply the
+// forces again after the logic, so that the ladder can't undo them.
+void CommandApply(Task *t);
+void CommandHold(Task *t);
+
+// Called by each task's scan thread, with ImageLock held, as it copies out
+// its outputs: let the I/O see the task's latest forces on pins.
+void CommandShowForces(Task *t);
+
+// Apply the forces on pins to the input or output image; called with
+// ImageLock held.
+void CommandForceInputs(IoWord *image);
+void CommandForceOutputs(IoWord *image);
+
+#endif
@@ -0,0 +1,286 @@
+//-----------------------------------------------------------------------------
+// The EEPROM for ldpi. LDmicro's PERSIST keeps a variable in EEPROM, so that
+// it survives a power cut: at startup it reads the variable back, and
+// while the ladder runs it compares the EEPROM copy with the variable every
+// scan and writes it when they differ, checking EEPROM BUSY first, as the
+// EEPROM on a microcontroller takes milliseconds to write.
+//
+// Here the EEPROM is EepromData[], in memory, so EEPROM READ is a plain load
+// and EEPROM WRITE a store, and the scan never waits for the disk. A write
+// that changes anything marks its 64-byte chunk dirty, and a thread of its
+// own, at ordinary priority, writes the dirty chunks to the file every
+// flush ms (1000 by default), so however often a counter changes it costs
+// the SD card at most one write a second. Use it with
+//
+//      --eeprom=FILE[,flush=MS]
+//
+// The file is mapped into memory, and holds two copies (slots) of the
+// EEPROM, each with a sequence number and a CRC of its contents. A flush
+// brings the older slot up to date (with the chunks that have changed
+// since it was last written: in this flush or the one before), gives it
+// the next sequence number, and msync()s just that slot; at startup the
+// valid slot with the higher number is the one read. So whenever the power
+// goes, the file holds either the EEPROM as of the last flush that
+// finished, or as of the one before it, and never half of one. EEPROM
+// BUSY reads set while a flush is being written.
+//
+// Without --eeprom, the EEPROM is only in memory, and starts out as zeros.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "eeprom.h"
+
+#define EEPROM_MAGIC            0x6c647065      // 'ldpe'
+#define CHUNK_WORDS             32              // 64 bytes
+#define CHUNKS                  (EEPROM_WORDS / CHUNK_WORDS)
+#define DIRTY_WORDS             ((CHUNKS + 63) / 64)
+
+typedef struct {
+    unsigned            magic;
+    unsigned            seq;
+    unsigned            size;
+    unsigned            crc;        // of data[]
+    SWORD               data[EEPROM_WORDS];
+} Slot;
+
+SWORD EepromData[EEPROM_WORDS];
+int EepromBusy;
+const char *EepromFile;
+int EepromUsed;
+unsigned long long EepromWrites, EepromFlushes, EepromBytesFlushed;
+Histogram EepromFlushTime;
+
+static long FlushMs = 1000;
+static unsigned long long Dirty[DIRTY_WORDS];
+// What was written to the newer slot by the last flush, and so is missing
+// from the older one; everything, to begin with.
+static unsigned long long Behind[DIRTY_WORDS];
+static BYTE *Map;
+static size_t Stride, MapSize;
+static int Newer = 1;       // the slot holding the last flush
+static unsigned Seq;
+static int Started;
+static pthread_t Thread;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake = PTHREAD_COND_INITIALIZER;
+
+void EepromConfigure(const char *args)
+{
+    static char file[128];
+    char buf[160], *p;
+
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+        if(strncmp(p, "flush=", 6) == 0) {
+            FlushMs = atol(p + 6);
+            if(FlushMs <= 0) {
+                fprintf(stderr, "eeprom: bad flush interval '%s'\n", p + 6);
+                exit(-1);
+            }
+        } else if(!EepromFile && *p) {
+            snprintf(file, sizeof(file), "%s", p);
+            EepromFile = file;
+        }
+    }
+    if(!EepromFile) {
+        fprintf(stderr, "eeprom: which file? (--eeprom=FILE)\n");
+        exit(-1);
+    }
+}
+
+void EepromWrite(int addr, SWORD v)
+{
+    int w = addr / 2, chunk = w / CHUNK_WORDS;
+
+    // LDmicro's PERSIST only writes a changed value anyway, but a ladder
+    // that writes the EEPROM itself might not.
+    if(__atomic_load_n(&EepromData[w], __ATOMIC_RELAXED) == v) return;
+    __atomic_store_n(&EepromData[w], v, __ATOMIC_RELAXED);
+    // Release, so that a flush that sees the chunk dirty sees the value.
+    __atomic_fetch_or(&Dirty[chunk / 64], 1ULL << (chunk % 64),
+        __ATOMIC_RELEASE);
+    __atomic_fetch_add(&EepromWrites, 1, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// The file.
+//-----------------------------------------------------------------------------
+static unsigned Crc32(const void *p, int len)
+{
+    const BYTE *b = p;
+    unsigned crc = ~0u;
+    int i;
+
+    while(len--) {
+        crc ^= *b++;
+        for(i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static Slot *SlotAt(int i)
+{
+    return (Slot *)(Map + i*Stride);
+}
+
+static int SlotValid(const Slot *s)
+{
+    return s->magic == EEPROM_MAGIC && s->size == EEPROM_SIZE &&
+        s->crc == Crc32(s->data, sizeof(s->data));
+}
+
+static void Open(void)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    int fd, i, valid[2];
+
+    // Each slot is in pages of its own, so that it can be msync()ed alone.
+    Stride = (sizeof(Slot) + page - 1) / page * page;
+    MapSize = 2*Stride;
+
+    if((fd = open(EepromFile, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ||
+        fstat(fd, &st) < 0)
+    {
+        perror(EepromFile);
+        exit(-1);
+    }
+    if(st.st_size == 0) {
+        if(ftruncate(fd, MapSize) < 0 || fsync(fd) < 0) {
+            perror(EepromFile);
+            exit(-1);
+        }
+    } else if(st.st_size != (off_t)MapSize) {
+        fprintf(stderr, "%s isn't an EEPROM file of this size (%d bytes)\n",
+            EepromFile, EEPROM_SIZE);
+        exit(-1);
+    }
+    Map = mmap(NULL, MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(Map == MAP_FAILED) {
+        perror(EepromFile);
+        exit(-1);
+    }
+
+    for(i = 0; i < 2; i++) valid[i] = SlotValid(SlotAt(i));
+    if(valid[0] && (!valid[1] || (int)(SlotAt(0)->seq - SlotAt(1)->seq) > 0)) {
+        Newer = 0;
+    } else if(valid[1]) {
+        Newer = 1;
+    } else {
+        Newer = 1;
+        printf("EEPROM %s is empty\n", EepromFile);
+        return;
+    }
+    Seq = SlotAt(Newer)->seq;
+    memcpy(EepromData, SlotAt(Newer)->data, sizeof(EepromData));
+    printf("EEPROM loaded from %s (flush %u)\n", EepromFile, Seq);
+}
+
+// Write what has changed into the older slot, and make it the newer.
+static void Flush(void)
+{
+    unsigned long long dirty[DIRTY_WORDS], bits;
+    struct timespec t0, t1;
+    Slot *s;
+    int i, any = 0, chunk, w;
+
+    for(i = 0; i < DIRTY_WORDS; i++) {
+        dirty[i] = __atomic_exchange_n(&Dirty[i], 0, __ATOMIC_ACQUIRE);
+        if(dirty[i]) any = 1;
+    }
+    if(!any) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    __atomic_store_n(&EepromBusy, 1, __ATOMIC_RELAXED);
+    s = SlotAt(Newer ^ 1);
+    for(i = 0; i < DIRTY_WORDS; i++) {
+        for(bits = dirty[i] | Behind[i]; bits; bits &= bits - 1) {
+            chunk = i*64 + __builtin_ctzll(bits);
+            for(w = chunk*CHUNK_WORDS; w < (chunk + 1)*CHUNK_WORDS; w++) {
+                s->data[w] = __atomic_load_n(&EepromData[w], __ATOMIC_RELAXED);
+            }
+            EepromBytesFlushed += 2*CHUNK_WORDS;
+        }
+    }
+    s->magic = EEPROM_MAGIC;
+    s->size = EEPROM_SIZE;
+    s->seq = ++Seq;
+    s->crc = Crc32(s->data, sizeof(s->data));
+    if(msync(s, Stride, MS_SYNC) < 0) {
+        LogPrintf("eeprom: %s: %s\n", EepromFile, strerror(errno));
+    }
+    Newer ^= 1;
+    memcpy(Behind, dirty, sizeof(Behind));
+    __atomic_store_n(&EepromBusy, 0, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    EepromFlushes++;
+    HistRecord(&EepromFlushTime, TimespecDiffNs(&t1, &t0));
+}
+
+static void *EepromThread(void *arg)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&Lock);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    while(Running) {
+        TimespecAddNs(&deadline, FlushMs*1000000LL);
+        while(Running && pthread_cond_timedwait(&Wake, &Lock, &deadline)
+            != ETIMEDOUT)
+            ;
+        pthread_mutex_unlock(&Lock);
+        Flush();
+        pthread_mutex_lock(&Lock);
+    }
+    pthread_mutex_unlock(&Lock);
+    return NULL;
+}
+
+void EepromStart(void)
+{
+    pthread_attr_t attr;
+    int i, err;
+
+    if(!EepromUsed) return;
+    if(!EepromFile) {
+        printf("the ladder uses the EEPROM, but no --eeprom was given; it "
+            "won't be kept\n");
+        return;
+    }
+    Open();
+    for(i = 0; i < CHUNKS; i++) Behind[i / 64] |= 1ULL << (i % 64);
+
+    RtThreadAttr(&attr, 0, -1);
+    if((err = pthread_create(&Thread, &attr, EepromThread, NULL)) != 0) {
+        fprintf(stderr, "couldn't start EEPROM thread: %s\n", strerror(err));
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    Started = 1;
+}
+
+void EepromStop(void)
+{
+    if(!Started) return;
+    pthread_mutex_lock(&Lock);
+    pthread_cond_signal(&Wake);
+    pthread_mutex_unlock(&Lock);
+    pthread_join(Thread, NULL);
+    Flush();
+    munmap(Map, MapSize);
+    Started = 0;
+}
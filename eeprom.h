@@ -0,0 +1,36 @@
+//-----------------------------------------------------------------------------
+// The EEPROM for ldpi's EEPROM READ and WRITE instructions (LDmicro's
+// PERSIST); see eeprom.c.
+//-----------------------------------------------------------------------------
+#ifndef __EEPROM_H
+#define __EEPROM_H
+
+#include "ldpi.h"
+
+// LDmicro gives each persistent variable two bytes of EEPROM, at an even
+// address.
+#define EEPROM_SIZE             1024
+#define EEPROM_WORDS            (EEPROM_SIZE / 2)
+
+// The ladder's view of the EEPROM; EEPROM READ is a load from here.
+extern SWORD EepromData[EEPROM_WORDS];
+
+// Set while a flush is being written, for EEPROM BUSY CHECK.
+extern int EepromBusy;
+
+extern const char *EepromFile;      // set by --eeprom
+extern int EepromUsed;              // nonzero if a ladder uses the EEPROM
+extern unsigned long long EepromWrites, EepromFlushes, EepromBytesFlushed;
+extern Histogram EepromFlushTime;
+
+void EepromConfigure(const char *args);
+
+// From the scan: write v at byte address addr (even, and in range).
+void EepromWrite(int addr, SWORD v);
+
+// Load the EEPROM from the file and start the flushing thread; flush what
+// is left and stop it at exit.
+void EepromStart(void);
+void EepromStop(void);
+
+#endif
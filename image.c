@@ -0,0 +1,117 @@
+//-----------------------------------------------------------------------------
+// The process image for ldpi. At the end of every scan each task copies its
+// bits and integers, with its scan count and times, into its slot in the
+// image, under a sequence lock (see ldpiimage.h). The copy is a few hundred
+// bytes and involves no system calls or locks, and nothing that a reader
+// does can make it wait. With --image the image is a POSIX shared-memory
+// segment that other programs can read with libldpiimage; ldpi's own
+// Modbus server reads it in the same way.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "image.h"
+
+#if LDPI_IMAGE_TASKS != MAX_TASKS || LDPI_IMAGE_BITS != MAX_INTERNAL_RELAYS \
+    || LDPI_IMAGE_INTS != MAX_VARIABLES || \
+    LDPI_IMAGE_SYMBOLS < MAX_TASKS*MAX_SYMBOLS || \
+    LDPI_IMAGE_NAME_LEN != MAX_SYMBOL_LEN
+#error "ldpiimage.h doesn't match the limits in ldpi.h"
+#endif
+
+LdpiImage *Image;
+int ImageShm;
+static char ImageName[64] = LDPI_IMAGE_DEFAULT;
+
+void ImageConfigure(const char *name)
+{
+    ImageShm = 1;
+    if(name) {
+        snprintf(ImageName, sizeof(ImageName), "%s%s",
+            *name == '/' ? "" : "/", name);
+    }
+}
+
+void ImageCreate(void)
+{
+    struct timespec mono, real;
+    int fd, i, k;
+
+    if(ImageShm) {
+        // Readers only ever map it read-only.
+        fd = shm_open(ImageName, O_RDWR | O_CREAT, 0644);
+        if(fd < 0 || ftruncate(fd, sizeof(LdpiImage)) != 0) {
+            perror(ImageName);
+            exit(-1);
+        }
+        Image = mmap(NULL, sizeof(LdpiImage), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        Image = mmap(NULL, sizeof(LdpiImage), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if(Image == MAP_FAILED) {
+        perror("process image");
+        exit(-1);
+    }
+
+    // Whatever an earlier ldpi left here is stale.
+    __atomic_store_n(&Image->magic, 0, __ATOMIC_RELEASE);
+    memset((char *)Image + sizeof(Image->magic), 0,
+        sizeof(LdpiImage) - sizeof(Image->magic));
+
+    Image->version = LDPI_IMAGE_VERSION;
+    Image->pid = getpid();
+    Image->taskCount = NumTasks;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    Image->realtimeOffset = TimespecDiffNs(&real, &mono);
+
+    for(i = 0; i < NumTasks; i++) {
+        const Task *t = &Tasks[i];
+        snprintf(Image->tasks[i].fileName, sizeof(Image->tasks[i].fileName),
+            "%s", t->fileName);
+        Image->tasks[i].cycleTime = t->cycleTime;
+        for(k = 0; k < t->symbolCount; k++) {
+            LdpiImageSymbol *s = &Image->symbols[Image->symbolCount++];
+            memcpy(s->name, t->symbols[k].name, sizeof(s->name));
+            s->addr = t->symbols[k].addr;
+            s->isInt = t->symbols[k].isInt;
+            s->task = i;
+        }
+    }
+    __atomic_store_n(&Image->magic, LDPI_IMAGE_MAGIC, __ATOMIC_RELEASE);
+
+    if(ImageShm) {
+        printf("Process image in shared memory %s (%u symbols)\n", ImageName,
+            Image->symbolCount);
+    }
+}
+
+void ImageDestroy(void)
+{
+    if(!Image) return;
+    __atomic_store_n(&Image->pid, 0, __ATOMIC_RELEASE);
+    if(ImageShm) shm_unlink(ImageName);
+}
+
+void ImagePublish(const Task *t, const struct timespec *start,
+    const struct timespec *end)
+{
+    LdpiImageTask *s = &Image->tasks[t - Tasks];
+    unsigned seq = s->seq;
+
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->cycles++;
+    s->scanStart = start->tv_sec*1000000000LL + start->tv_nsec;
+    s->scanEnd = end->tv_sec*1000000000LL + end->tv_nsec;
+    memcpy(s->bits, t->bits, sizeof(s->bits));
+    memcpy(s->integers, t->integers, sizeof(s->integers));
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
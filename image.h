@@ -0,0 +1,28 @@
+//-----------------------------------------------------------------------------
+// The writer side of the process image for ldpi; see image.c.
+//-----------------------------------------------------------------------------
+#ifndef __IMAGE_H
+#define __IMAGE_H
+
+#include "ldpi.h"
+#include "ldpiimage.h"
+
+// The image, once ImageCreate() has been called; NULL if nobody wants it.
+extern LdpiImage *Image;
+
+extern int ImageShm;             // nonzero for --image
+
+// Take a --image[=name] option.
+void ImageConfigure(const char *name);
+
+// Set up the image for all of the tasks: in shared memory for --image,
+// otherwise (for the Modbus server) in our own memory.
+void ImageCreate(void);
+// Mark the image as no longer being written, and remove its name.
+void ImageDestroy(void);
+
+// Called by each task at the end of its scan, which started at start.
+void ImagePublish(const Task *t, const struct timespec *start,
+    const struct timespec *end);
+
+#endif
@@ -0,0 +1,430 @@
+//-----------------------------------------------------------------------------
+// Selection of the I/O backend for ldpi; see io.h.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "io.h"
+
+static IoBackend *Backends[] = {
+#ifndef NO_WIRINGPI
+    &WiringPiBackend,
+#endif
+    &SimBackend,
+    &GpiochipBackend,
+    &GpiomemBackend,
+    &UdpBackend,
+    NULL
+};
+
+#define NUM_BACKENDS            (sizeof(Backends)/sizeof(Backends[0]) - 1)
+
+IoBackend *Io;
+// The args from --io=name:args, for each backend.
+static const char *Args[NUM_BACKENDS];
+
+// A backend in use, and the pins that it looks after.
+typedef struct {
+    IoBackend  *backend;
+    IoWord      inputs[IO_WORDS];
+    IoWord      outputs[IO_WORDS];
+} IoPort;
+
+static IoPort Ports[NUM_BACKENDS];
+static int PortCount, AnyCyclic;
+
+// The names given to pins by the map file, and which backend each pin is
+// on (NULL for the default one).
+typedef struct {
+    char        name[MAX_SYMBOL_LEN];
+    int         pin;
+    int         output;
+} IoAlias;
+
+static IoAlias Aliases[2*MAX_PINS];
+static int AliasCount;
+static IoBackend *PinBackend[MAX_PINS];
+
+// The active-low pins, whose level is the opposite of the ladder's value.
+IoWord IoInvert[IO_WORDS];
+static int AnyInverted;
+
+// The input debounce filter. Each filtered pin has a counter of how many
+// scans in a row it has read differently from its debounced value; when
+// that reaches the pin's threshold, the debounced value flips. The counters
+// and thresholds are kept as bit planes (vertical counters: bit k of every
+// pin's count in one word), so that a whole word of pins is filtered with
+// a dozen or so logic operations, however many pins there are and whatever
+// their thresholds.
+int IoDebounce;
+static int PinDebounce[MAX_PINS];       // from the map; 0 for IoDebounce
+static IoWord Filtered[IO_WORDS];
+static IoWord Threshold[DEBOUNCE_BITS][IO_WORDS];
+static IoWord Count[DEBOUNCE_BITS][IO_WORDS];
+static IoWord Stable[IO_WORDS];
+static int AnyFiltered, Primed;
+
+int IoRefresh = 1000;
+int IoEdges;
+Histogram IoLatency;
+unsigned long long IoWrites, IoPinWrites, IoPinsSuppressed;
+
+// What we last wrote to the outputs, and how many more writes until the
+// next full refresh.
+static IoWord Shadow[IO_WORDS];
+static int UntilRefresh;
+static int OutputCount;
+
+// The time of the first edge seen by the last read of the inputs, if the
+// outputs have not been written since.
+static long long EdgeTime;
+
+static int FindBackend(const char *name, size_t len)
+{
+    int i;
+
+    for(i = 0; Backends[i]; i++) {
+        if(strlen(Backends[i]->name) == len &&
+            strncmp(Backends[i]->name, name, len) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void UnknownBackend(const char *name)
+{
+    int i;
+
+    fprintf(stderr, "unknown I/O backend '%s'; this ldpi has:", name);
+    for(i = 0; Backends[i]; i++) fprintf(stderr, " %s", Backends[i]->name);
+    fprintf(stderr, "\n");
+    exit(-1);
+}
+
+void IoSelect(const char *spec)
+{
+    const char *colon = strchr(spec, ':');
+    int i = FindBackend(spec, colon ? (size_t)(colon - spec) : strlen(spec));
+
+    if(i < 0) UnknownBackend(spec);
+    if(!Io) Io = Backends[i];
+    Args[i] = colon ? colon + 1 : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// The pin map. Any bit called GPIn (or XGPIn, or anything else ending in
+// GPIn) is input pin n, and GPOn is output pin n; a map file can give pins
+// other names, and say more about them, with lines like
+//
+//      # pin   name        options
+//      GPI3    Xstart      low
+//      GPO17   Ymotor      io=sim
+//      GPI5    -           low
+//
+// where the name - just sets the options for a pin that the ladder calls
+// GPIn or GPOn itself. low makes the pin active-low, debounce=n makes an
+// input change only once it has read the same for n scans in a row (up to
+// DEBOUNCE_MAX), and io=name puts the pin on that backend instead of the
+// default one, so that several backends can be used at once.
+//-----------------------------------------------------------------------------
+// The n of a name that starts GPIn or GPOn, or -1; an n that is too big
+// comes back as MAX_PINS.
+static int ParsePin(const char *s, int *output)
+{
+    char *end;
+    long n;
+
+    if(strncmp(s, "GPI", 3) == 0) {
+        *output = 0;
+    } else if(strncmp(s, "GPO", 3) == 0) {
+        *output = 1;
+    } else {
+        return -1;
+    }
+    if(!isdigit((unsigned char)s[3])) return -1;
+    n = strtol(s + 3, &end, 10);
+    if(*end) return -1;
+    return n < MAX_PINS ? (int)n : MAX_PINS;
+}
+
+void IoLoadMap(const char *fileName)
+{
+    FILE *f = fopen(fileName, "r");
+    char line[256], *pinName, *name, *opt;
+    int lineNo = 0, pin, output, k;
+
+    if(!f) {
+        perror(fileName);
+        exit(-1);
+    }
+    while(fgets(line, sizeof(line), f)) {
+        lineNo++;
+        if((opt = strchr(line, '#'))) *opt = '\0';
+        if(!(pinName = strtok(line, " \t\r\n"))) continue;
+        name = strtok(NULL, " \t\r\n");
+
+        pin = ParsePin(pinName, &output);
+        if(pin < 0 || pin >= MAX_PINS || !name) {
+            fprintf(stderr, "%s:%d: expected GPIn or GPOn (n < %d) and a "
+                "name\n", fileName, lineNo, MAX_PINS);
+            exit(-1);
+        }
+        if(strcmp(name, "-") != 0) {
+            IoAlias *a = &Aliases[AliasCount];
+            if(AliasCount >= (int)(sizeof(Aliases)/sizeof(Aliases[0]))) {
+                fprintf(stderr, "%s:%d: too many names\n", fileName, lineNo);
+                exit(-1);
+            }
+            strncpy(a->name, name, sizeof(a->name) - 1);
+            a->pin = pin;
+            a->output = output;
+            AliasCount++;
+        }
+
+        while((opt = strtok(NULL, " \t\r\n"))) {
+            if(strcmp(opt, "low") == 0) {
+                IO_SET(IoInvert, pin, 1);
+                AnyInverted = 1;
+            } else if(strncmp(opt, "debounce=", 9) == 0) {
+                PinDebounce[pin] = atoi(opt + 9);
+                if(output || PinDebounce[pin] < 1 ||
+                    PinDebounce[pin] > DEBOUNCE_MAX)
+                {
+                    fprintf(stderr, "%s:%d: debounce is for inputs, 1 to %d "
+                        "scans\n", fileName, lineNo, DEBOUNCE_MAX);
+                    exit(-1);
+                }
+            } else if(strncmp(opt, "io=", 3) == 0) {
+                if((k = FindBackend(opt + 3, strlen(opt + 3))) < 0) {
+                    UnknownBackend(opt + 3);
+                }
+                PinBackend[pin] = Backends[k];
+            } else {
+                fprintf(stderr, "%s:%d: unknown option '%s'\n", fileName,
+                    lineNo, opt);
+                exit(-1);
+            }
+        }
+    }
+    fclose(f);
+}
+
+int IoPinOf(const char *name, int *output)
+{
+    const char *p;
+    int i;
+
+    for(i = 0; i < AliasCount; i++) {
+        if(strcmp(Aliases[i].name, name) == 0) {
+            *output = Aliases[i].output;
+            return Aliases[i].pin;
+        }
+    }
+    for(p = name; (p = strstr(p, "GP")); p++) {
+        int pin = ParsePin(p, output);
+        if(pin >= 0) return pin;
+    }
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Setting up, reading and writing. Each backend only ever sees the pins
+// that are on it; with only one backend in use (the usual case) the image
+// goes straight through.
+//-----------------------------------------------------------------------------
+void IoInit(void)
+{
+    int i, k, pin;
+
+    if(!Io) Io = Backends[0];
+    for(k = 0; Backends[k]; k++) {
+        IoPort *port = &Ports[PortCount];
+        int used = (Backends[k] == Io);
+
+        memset(port, 0, sizeof(*port));
+        for(pin = 0; pin < MAX_PINS; pin++) {
+            IoBackend *b = PinBackend[pin] ? PinBackend[pin] : Io;
+            if(b != Backends[k]) continue;
+            if(IO_GET(InputPins, pin)) IO_SET(port->inputs, pin, 1);
+            if(IO_GET(OutputPins, pin)) IO_SET(port->outputs, pin, 1);
+        }
+        for(i = 0; i < IO_WORDS; i++) {
+            if(port->inputs[i] || port->outputs[i]) used = 1;
+        }
+        if(!used) continue;
+
+        port->backend = Backends[k];
+        if(IoEdges && !(Backends[k]->caps & IO_CAP_EDGES)) {
+            fprintf(stderr, "the %s backend can't report input edges\n",
+                Backends[k]->name);
+            exit(-1);
+        }
+        printf("Setting up %s I/O...\n", Backends[k]->name);
+        Backends[k]->init(Args[k], port->inputs, port->outputs);
+        if(Backends[k]->caps & IO_CAP_CYCLIC) AnyCyclic = 1;
+        PortCount++;
+    }
+
+    for(i = 0; i < IO_WORDS; i++) {
+        OutputCount += __builtin_popcount(OutputPins[i]);
+    }
+    UntilRefresh = 0;
+
+    for(pin = 0; pin < MAX_PINS; pin++) {
+        int n = PinDebounce[pin] ? PinDebounce[pin] : IoDebounce;
+        if(n <= 1 || !IO_GET(InputPins, pin)) continue;
+        IO_SET(Filtered, pin, 1);
+        for(k = 0; k < DEBOUNCE_BITS; k++) {
+            IO_SET(Threshold[k], pin, (n >> k) & 1);
+        }
+        AnyFiltered = 1;
+    }
+}
+
+static void Debounce(IoWord *image)
+{
+    IoWord raw, diff, carry, miss, fire, c;
+    int i, k;
+
+    if(!Primed) {
+        memcpy(Stable, image, sizeof(Stable));
+        Primed = 1;
+    }
+    for(i = 0; i < IO_WORDS; i++) {
+        if(!Filtered[i]) continue;
+        raw = image[i];
+
+        // Count up the pins that differ from their debounced value, and
+        // clear the counts of the others; then flip those whose count has
+        // reached the threshold.
+        diff = (raw ^ Stable[i]) & Filtered[i];
+        carry = diff;
+        miss = 0;
+        for(k = 0; k < DEBOUNCE_BITS; k++) {
+            c = Count[k][i];
+            Count[k][i] = (c ^ carry) & diff;
+            carry &= c;
+            miss |= Count[k][i] ^ Threshold[k][i];
+        }
+        fire = diff & ~miss;
+        Stable[i] ^= fire;
+        for(k = 0; k < DEBOUNCE_BITS; k++) Count[k][i] &= ~fire;
+
+        image[i] = (raw & ~Filtered[i]) | (Stable[i] & Filtered[i]);
+    }
+}
+
+int IoEventFds(int priority, int *fds)
+{
+    int k, n = 0;
+
+    for(k = 0; k < PortCount; k++) {
+        IoBackend *b = Ports[k].backend;
+        int fd = b->eventFd ? b->eventFd(priority) : -1;
+        if(fd < 0) {
+            fprintf(stderr, "the %s backend can't report input edges\n",
+                b->name);
+            exit(-1);
+        }
+        fds[n++] = fd;
+    }
+    return n;
+}
+
+// Take the edges first, so that they can't be later than the read that
+// sees them.
+static void TakeEdges(void)
+{
+    int k;
+
+    if(!IoEdges) return;
+    for(k = 0; k < PortCount; k++) {
+        long long t = Ports[k].backend->takeEdge();
+        if(t && (!EdgeTime || t < EdgeTime)) EdgeTime = t;
+    }
+}
+
+void IoReadInputs(IoWord *image)
+{
+    IoWord part[IO_WORDS];
+    int i, k;
+
+    TakeEdges();
+    if(PortCount == 1) {
+        Ports[0].backend->readInputs(image);
+    } else {
+        memset(image, 0, IO_WORDS*sizeof(IoWord));
+        for(k = 0; k < PortCount; k++) {
+            Ports[k].backend->readInputs(part);
+            for(i = 0; i < IO_WORDS; i++) {
+                image[i] |= part[i] & Ports[k].inputs[i];
+            }
+        }
+    }
+    if(AnyInverted) {
+        for(i = 0; i < IO_WORDS; i++) image[i] ^= IoInvert[i] & InputPins[i];
+    }
+    if(AnyFiltered) Debounce(image);
+}
+
+void IoWriteOutputs(const IoWord *image)
+{
+    IoWord changed[IO_WORDS], level[IO_WORDS], part[IO_WORDS], any = 0;
+    int i, k, n = 0;
+
+    if(--UntilRefresh <= 0) {
+        UntilRefresh = IoRefresh;
+        memcpy(changed, OutputPins, sizeof(changed));
+        any = 1;
+    } else {
+        for(i = 0; i < IO_WORDS; i++) {
+            changed[i] = (image[i] ^ Shadow[i]) & OutputPins[i];
+            any |= changed[i];
+        }
+    }
+
+    // A cyclic backend is written every time, if only to say that nothing
+    // has changed.
+    if(any || AnyCyclic) {
+        for(i = 0; i < IO_WORDS; i++) {
+            level[i] = image[i] ^ IoInvert[i];
+            Shadow[i] = image[i];
+            n += __builtin_popcount(changed[i]);
+        }
+        for(k = 0; k < PortCount; k++) {
+            IoWord some = 0;
+            for(i = 0; i < IO_WORDS; i++) {
+                part[i] = changed[i] & Ports[k].outputs[i];
+                some |= part[i];
+            }
+            if(some || (Ports[k].backend->caps & IO_CAP_CYCLIC)) {
+                Ports[k].backend->writeOutputs(level, part);
+            }
+        }
+        if(any) IoWrites++;
+    }
+    IoPinWrites += n;
+    IoPinsSuppressed += OutputCount - n;
+
+    if(EdgeTime) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        HistRecord(&IoLatency, now.tv_sec*1000000000LL + now.tv_nsec -
+            EdgeTime);
+        EdgeTime = 0;
+    }
+}
+
+int WiringPiToBcm(int pin)
+{
+    static const int bcm[] = {
+        17, 18, 27, 22, 23, 24, 25,  4,  2,  3,  8,  7, 10,  9, 11, 14,
+        15, 28, 29, 30, 31,  5,  6, 13, 19, 26, 12, 16, 20, 21,  0,  1,
+    };
+    if(pin < 0 || pin >= (int)(sizeof(bcm)/sizeof(bcm[0]))) return -1;
+    return bcm[pin];
+}
@@ -0,0 +1,111 @@
+//-----------------------------------------------------------------------------
+// The interface between ldpi and whatever actually reads and writes the
+// pins. A backend is a table of functions that move a whole image of the
+// pins (packed one bit per pin, see ldpi.h) at a time; ldpi picks one with
+// --io=name[:args] and never touches the hardware itself.
+//-----------------------------------------------------------------------------
+#ifndef __IO_H
+#define __IO_H
+
+#include "ldpi.h"
+
+// What a backend can do.
+#define IO_CAP_INPUTS           0x01
+#define IO_CAP_OUTPUTS          0x02
+#define IO_CAP_BULK             0x04    // all pins in one access
+#define IO_CAP_SIMULATED        0x08    // not real hardware
+#define IO_CAP_EDGES            0x10    // can report input edges
+#define IO_CAP_CYCLIC           0x20    // writeOutputs every scan, changed
+                                        // or not
+
+typedef struct {
+    const char *name;
+    unsigned    caps;
+
+    // Set up the pins set in inputs[] and outputs[], given the args from
+    // --io=name:args (or NULL). Exits with a message if that fails.
+    void        (*init)(const char *args, const IoWord *inputs,
+                    const IoWord *outputs);
+    // Read all of the inputs into image[]; the other bits are cleared.
+    void        (*readInputs)(IoWord *image);
+    // Write the outputs set in changed[] from image[]; the others are
+    // already right.
+    void        (*writeOutputs)(const IoWord *image, const IoWord *changed);
+
+    // The rest is only for backends with IO_CAP_EDGES, and only used when
+    // IoEdges was set before init. eventFd returns a descriptor that
+    // becomes readable when an input changes (starting, at the given
+    // priority, any thread that needs); takeEdge returns the
+    // CLOCK_MONOTONIC time in ns of the first edge since it was last
+    // called, or 0 if there has been none, and clears the descriptor.
+    int         (*eventFd)(int priority);
+    long long   (*takeEdge)(void);
+} IoBackend;
+
+extern IoBackend WiringPiBackend;
+extern IoBackend SimBackend;
+extern IoBackend GpiomemBackend;
+extern IoBackend GpiochipBackend;
+extern IoBackend UdpBackend;
+
+// The remote I/O backend's round trips, and counts of its frames: sent,
+// answered, never answered, answered out of order (and ignored), and times
+// that the node stopped answering altogether.
+extern Histogram UdpRoundTrip;
+extern unsigned long long UdpSent, UdpReceived, UdpLost, UdpLate;
+extern unsigned long UdpTimeouts;
+
+// The BCM GPIO number of wiringPi pin n (on rev 2 and later boards), or -1.
+int WiringPiToBcm(int pin);
+
+// The default backend.
+extern IoBackend *Io;
+
+// Take a --io=name[:args] option. The first one picks the default backend;
+// any others just give the args for backends that the map puts pins on.
+void IoSelect(const char *spec);
+
+// Read a pin map file (--map); see io.c.
+void IoLoadMap(const char *fileName);
+
+// The pin that a bit called name in the ladder is, from the map or from
+// its name (GPIn or GPOn), or -1 if it is not a pin; *output is set for an
+// output.
+int IoPinOf(const char *name, int *output);
+
+// The active-low pins.
+extern IoWord IoInvert[IO_WORDS];
+
+// The debounce filter: an input only changes once it has read the same for
+// IoDebounce (--debounce) scans of the I/O task in a row, or as many as the
+// map says for that pin. 0 or 1 turns the filter off.
+#define DEBOUNCE_BITS           4
+#define DEBOUNCE_MAX            ((1 << DEBOUNCE_BITS) - 1)
+extern int IoDebounce;
+
+// Set up the backends for the pins in InputPins and OutputPins.
+void IoInit(void);
+
+// Put the descriptors from every backend's eventFd() into fds[], for
+// --react, and return how many there are.
+int IoEventFds(int priority, int *fds);
+
+// Read the inputs, and write the outputs, through the backends.
+// Only the outputs that have changed since they were last written are
+// written, except that every IoRefresh'th time all of them are (in case
+// something else has disturbed them); IoRefresh = 1 writes them all every
+// time.
+extern int IoRefresh;
+void IoReadInputs(IoWord *image);
+void IoWriteOutputs(const IoWord *image);
+
+// With IoEdges set (for --react or --latency), the time from each input
+// edge to the writing of the outputs from the scan that saw it.
+extern int IoEdges;
+extern Histogram IoLatency;
+
+// Counts of output writes: calls that wrote something, and pin writes that
+// were done and that were skipped because the pin had not changed.
+extern unsigned long long IoWrites, IoPinWrites, IoPinsSuppressed;
+
+#endif
@@ -0,0 +1,185 @@
+//-----------------------------------------------------------------------------
+// The GPIO character-device backend for ldpi, using the kernel's GPIO v2
+// API. All of the input lines are requested as one handle and all of the
+// output lines as another, when ldpi starts, so that each scan needs just
+// one ioctl to read every input and one to write every output. Use it with
+//
+//      --io=gpiochip[:/dev/gpiochipN][,bcm][,debounce=us]
+//
+// By default pin n is wiringPi pin n, which on the Pi's main chip is line
+// (BCM GPIO) WiringPiToBcm(n); with bcm, pin n is line n. debounce asks the
+// kernel to debounce the inputs, where the driver can. For --react and
+// --latency the input lines are also asked for edge events, which the
+// kernel timestamps, and the line request itself is what epoll waits on.
+// Without a Pi, the gpio-sim (or older gpio-mockup) kernel module makes a
+// chip to test with.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "io.h"
+
+static int InFd = -1, OutFd = -1;
+
+// Which pin each line of the two requests is.
+static int InPin[MAX_PINS], InCount;
+static int OutPin[MAX_PINS], OutCount;
+
+static int RequestLines(int chip, const char *path, const int *lines, int n,
+    unsigned long long flags, unsigned debounce)
+{
+    struct gpio_v2_line_request req;
+    int i;
+
+    memset(&req, 0, sizeof(req));
+    for(i = 0; i < n; i++) req.offsets[i] = lines[i];
+    req.num_lines = n;
+    req.config.flags = flags;
+    if(debounce) {
+        req.config.num_attrs = 1;
+        req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+        req.config.attrs[0].attr.debounce_period_us = debounce;
+        req.config.attrs[0].mask = (n >= 64) ? ~0ULL : (1ULL << n) - 1;
+    }
+    strcpy(req.consumer, "ldpi");
+
+    if(ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        perror(path);
+        exit(-1);
+    }
+    return req.fd;
+}
+
+static void GpiochipInit(const char *args, const IoWord *inputs,
+    const IoWord *outputs)
+{
+    char path[128] = "/dev/gpiochip0", buf[128], *p;
+    int inLines[MAX_PINS], outLines[MAX_PINS];
+    unsigned debounce = 0;
+    int bcm = 0, chip, pin;
+
+    if(args) {
+        strncpy(buf, args, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+        for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+            if(strcmp(p, "bcm") == 0) {
+                bcm = 1;
+            } else if(strncmp(p, "debounce=", 9) == 0) {
+                debounce = atoi(p + 9);
+            } else if(*p) {
+                strncpy(path, p, sizeof(path) - 1);
+            }
+        }
+    }
+
+    for(pin = 0; pin < MAX_PINS; pin++) {
+        int line = bcm ? pin : WiringPiToBcm(pin);
+
+        if(!IO_GET(inputs, pin) && !IO_GET(outputs, pin)) continue;
+        if(line < 0) {
+            fprintf(stderr, "gpiochip: no line for pin %d\n", pin);
+            exit(-1);
+        }
+        if(IO_GET(inputs, pin)) {
+            InPin[InCount] = pin;
+            inLines[InCount++] = line;
+        } else {
+            OutPin[OutCount] = pin;
+            outLines[OutCount++] = line;
+        }
+    }
+
+    if((chip = open(path, O_RDWR)) < 0) {
+        perror(path);
+        exit(-1);
+    }
+    if(InCount) {
+        InFd = RequestLines(chip, path, inLines, InCount,
+            GPIO_V2_LINE_FLAG_INPUT | (IoEdges ?
+            GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING :
+            0), debounce);
+        if(IoEdges) fcntl(InFd, F_SETFL, fcntl(InFd, F_GETFL) | O_NONBLOCK);
+    }
+    if(OutCount) {
+        OutFd = RequestLines(chip, path, outLines, OutCount,
+            GPIO_V2_LINE_FLAG_OUTPUT, 0);
+    }
+    close(chip);
+
+    printf("\t%d input and %d output lines on %s", InCount, OutCount, path);
+    if(debounce) printf(", debounced %u us", debounce);
+    printf("\n");
+}
+
+static void GpiochipReadInputs(IoWord *image)
+{
+    struct gpio_v2_line_values v;
+    int i;
+
+    memset(image, 0, IO_WORDS*sizeof(IoWord));
+    if(InFd < 0) return;
+
+    v.bits = 0;
+    v.mask = (InCount >= 64) ? ~0ULL : (1ULL << InCount) - 1;
+    if(ioctl(InFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &v) < 0) return;
+    for(i = 0; i < InCount; i++) {
+        if((v.bits >> i) & 1) IO_SET(image, InPin[i], 1);
+    }
+}
+
+static void GpiochipWriteOutputs(const IoWord *image, const IoWord *changed)
+{
+    struct gpio_v2_line_values v;
+    int i;
+
+    if(OutFd < 0) return;
+
+    v.bits = 0;
+    v.mask = 0;
+    for(i = 0; i < OutCount; i++) {
+        if(IO_GET(changed, OutPin[i])) v.mask |= 1ULL << i;
+        if(IO_GET(image, OutPin[i])) v.bits |= 1ULL << i;
+    }
+    if(v.mask) ioctl(OutFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+}
+
+static int GpiochipEventFd(int priority)
+{
+    if(InCount == 0) {
+        fprintf(stderr, "gpiochip: no input lines to wait for edges on\n");
+        exit(-1);
+    }
+    return InFd;
+}
+
+static long long GpiochipTakeEdge(void)
+{
+    struct gpio_v2_line_event ev[16];
+    long long first = 0;
+    ssize_t n;
+    int i;
+
+    if(InFd < 0) return 0;
+    while((n = read(InFd, ev, sizeof(ev))) > 0) {
+        for(i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+            long long ts = ev[i].timestamp_ns;
+            if(!first || ts < first) first = ts;
+        }
+    }
+    return first;
+}
+
+IoBackend GpiochipBackend = {
+    "gpiochip",
+    IO_CAP_INPUTS | IO_CAP_OUTPUTS | IO_CAP_BULK | IO_CAP_EDGES,
+    GpiochipInit,
+    GpiochipReadInputs,
+    GpiochipWriteOutputs,
+    GpiochipEventFd,
+    GpiochipTakeEdge,
+};
@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------
+// The memory-mapped GPIO backend for ldpi. It maps the BCM2835 GPIO block
+// through /dev/gpiomem (which needs no root) and then reads every input
+// with a single load from GPLEV0 and writes every output with one store to
+// GPSET0 and one to GPCLR0 (or fewer, if nothing needs setting or
+// clearing), so the cost of the I/O hardly depends on how many pins are
+// used. Use it with
+//
+//      --io=gpiomem[:path][,bcm]
+//
+// By default pin n is wiringPi pin n, as with the wiringPi backend; with
+// bcm it is BCM GPIO n, and the register words go straight into the image
+// without any shuffling of bits. If path is a regular file instead of a
+// device, it is created if need be and used as a stand-in for the
+// registers (with GPLEV0 following what is written to GPSET0 and GPCLR0,
+// as it would for an output pin), so this can be tested off the Pi.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "io.h"
+
+// Register offsets, in words, from the start of the GPIO block.
+#define GPFSEL0                 0
+#define GPSET0                  7
+#define GPCLR0                  10
+#define GPLEV0                  13
+#define GPIO_BLOCK_SIZE         4096
+
+static volatile unsigned *Gpio;
+static int StandIn;
+
+// The pins we use, as image bits and as the matching bits of GPLEV0.
+static int InPin[MAX_PINS], InBcm[MAX_PINS], InCount;
+static int OutPin[MAX_PINS], OutBcm[MAX_PINS], OutCount;
+static unsigned InMask, OutMask;
+static int Direct;      // pin n is bit n of GPLEV0, so just mask
+
+static void SetFunction(int bcm, int output)
+{
+    volatile unsigned *fsel = &Gpio[GPFSEL0 + bcm/10];
+    int shift = (bcm % 10)*3;
+    *fsel = (*fsel & ~(7u << shift)) | ((output ? 1u : 0u) << shift);
+}
+
+static void GpiomemInit(const char *args, const IoWord *inputs,
+    const IoWord *outputs)
+{
+    char path[128] = "/dev/gpiomem", buf[128], *p;
+    int bcm = 0, fd, pin;
+    struct stat st;
+
+    if(args) {
+        strncpy(buf, args, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+        for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+            if(strcmp(p, "bcm") == 0) {
+                bcm = 1;
+            } else if(*p) {
+                strncpy(path, p, sizeof(path) - 1);
+            }
+        }
+    }
+
+    StandIn = stat(path, &st) != 0 || S_ISREG(st.st_mode);
+    fd = open(path, O_RDWR | O_SYNC | (StandIn ? O_CREAT : 0), 0666);
+    if(fd < 0 || (StandIn && ftruncate(fd, GPIO_BLOCK_SIZE) != 0)) {
+        perror(path);
+        exit(-1);
+    }
+    Gpio = mmap(NULL, GPIO_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+        0);
+    close(fd);
+    if(Gpio == MAP_FAILED) {
+        perror("mmap");
+        exit(-1);
+    }
+
+    Direct = bcm;
+    for(pin = 0; pin < MAX_PINS; pin++) {
+        int b = bcm ? pin : WiringPiToBcm(pin);
+
+        if(!IO_GET(inputs, pin) && !IO_GET(outputs, pin)) continue;
+        if(b < 0 || b >= 32) {
+            fprintf(stderr, "gpiomem: pin %d is not in GPIO bank 0\n", pin);
+            exit(-1);
+        }
+        if(b != pin) Direct = 0;
+
+        if(IO_GET(inputs, pin)) {
+            InPin[InCount] = pin;
+            InBcm[InCount++] = b;
+            InMask |= 1u << b;
+            SetFunction(b, 0);
+        } else {
+            OutPin[OutCount] = pin;
+            OutBcm[OutCount++] = b;
+            OutMask |= 1u << b;
+            SetFunction(b, 1);
+        }
+    }
+    printf("\tGPIO registers at %s%s%s\n", path, StandIn ? " (stand-in)" : "",
+        Direct ? ", BCM numbering" : "");
+}
+
+static void GpiomemReadInputs(IoWord *image)
+{
+    unsigned lev = Gpio[GPLEV0];
+    int i;
+
+    memset(image, 0, IO_WORDS*sizeof(IoWord));
+    if(Direct) {
+        image[0] = lev & InMask;
+        return;
+    }
+    for(i = 0; i < InCount; i++) {
+        image[0] |= ((lev >> InBcm[i]) & 1u) << InPin[i];
+    }
+}
+
+static void GpiomemWriteOutputs(const IoWord *image, const IoWord *changed)
+{
+    unsigned set = 0, mask = 0;
+    int i;
+
+    if(Direct) {
+        set = image[0] & OutMask;
+        mask = changed[0] & OutMask;
+    } else {
+        for(i = 0; i < OutCount; i++) {
+            set |= ((image[0] >> OutPin[i]) & 1u) << OutBcm[i];
+            mask |= ((changed[0] >> OutPin[i]) & 1u) << OutBcm[i];
+        }
+    }
+    if(set & mask) Gpio[GPSET0] = set & mask;
+    if(~set & mask) Gpio[GPCLR0] = ~set & mask;
+
+    if(StandIn) Gpio[GPLEV0] = (Gpio[GPLEV0] & ~mask) | (set & mask);
+}
+
+IoBackend GpiomemBackend = {
+    "gpiomem",
+    IO_CAP_INPUTS | IO_CAP_OUTPUTS | IO_CAP_BULK,
+    GpiomemInit,
+    GpiomemReadInputs,
+    GpiomemWriteOutputs,
+    NULL,
+    NULL,
+};
@@ -0,0 +1,161 @@
+//-----------------------------------------------------------------------------
+// The simulated I/O backend for ldpi. The pins live in a POSIX shared-memory
+// segment (laid out as in ldpisim.h) instead of in hardware, so that ldpi
+// can run, and be tested and benchmarked, on any Linux machine. Use it with
+//
+//      --io=sim[:name][,delay=us]
+//
+// where name is the shared-memory object (/ldpi by default), and delay
+// makes every read and write take that long, to stand in for slow I/O.
+//
+// For --react, a watcher thread sleeps on the harness's futex (inputSeq)
+// and passes each wake-up on through an eventfd, which is what ldpi's
+// epoll loop waits on.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "io.h"
+#include "rt.h"
+#include "ldpisim.h"
+
+static LdpiSim *Sim;
+static long Delay;
+static int EventFd = -1;
+static pthread_t Watcher;
+
+static void SimInit(const char *args, const IoWord *inputs,
+    const IoWord *outputs)
+{
+    char name[64] = LDPI_SIM_DEFAULT, *p;
+    int fd, i;
+
+    if(args) {
+        char buf[128];
+        strncpy(buf, args, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+        for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+            if(strncmp(p, "delay=", 6) == 0) {
+                Delay = atol(p + 6);
+            } else if(*p) {
+                snprintf(name, sizeof(name), "%s%s", *p == '/' ? "" : "/", p);
+            }
+        }
+    }
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+    if(fd < 0 || ftruncate(fd, sizeof(LdpiSim)) != 0) {
+        perror(name);
+        exit(-1);
+    }
+    Sim = mmap(NULL, sizeof(LdpiSim), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+        0);
+    close(fd);
+    if(Sim == MAP_FAILED) {
+        perror("mmap");
+        exit(-1);
+    }
+
+    // Leave the inputs alone, in case the harness has already set them.
+    memset(Sim->outputs, 0, sizeof(Sim->outputs));
+    memset(Sim->inputPins, 0, sizeof(Sim->inputPins));
+    memset(Sim->outputPins, 0, sizeof(Sim->outputPins));
+    for(i = 0; i < IO_WORDS && i < LDPI_SIM_WORDS; i++) {
+        Sim->inputPins[i] = inputs[i];
+        Sim->outputPins[i] = outputs[i];
+    }
+    if(IoEdges) __atomic_store_n(&Sim->inputTime, 0, __ATOMIC_RELAXED);
+    Sim->version = LDPI_SIM_VERSION;
+    __atomic_store_n(&Sim->magic, LDPI_SIM_MAGIC, __ATOMIC_RELEASE);
+    printf("\tsimulated pins in shared memory %s\n", name);
+}
+
+static void SimReadInputs(IoWord *image)
+{
+    int i;
+
+    if(Delay) usleep(Delay);
+    for(i = 0; i < IO_WORDS; i++) {
+        image[i] = i < LDPI_SIM_WORDS ?
+            __atomic_load_n(&Sim->inputs[i], __ATOMIC_ACQUIRE) &
+            Sim->inputPins[i] : 0;
+    }
+    __atomic_fetch_add(&Sim->reads, 1, __ATOMIC_RELEASE);
+}
+
+static void SimWriteOutputs(const IoWord *image, const IoWord *changed)
+{
+    int i;
+
+    if(Delay) usleep(Delay);
+    for(i = 0; i < IO_WORDS && i < LDPI_SIM_WORDS; i++) {
+        unsigned v = __atomic_load_n(&Sim->outputs[i], __ATOMIC_RELAXED);
+        v = (v & ~changed[i]) | (image[i] & changed[i]);
+        __atomic_store_n(&Sim->outputs[i], v, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_add(&Sim->writes, 1, __ATOMIC_RELEASE);
+}
+
+static void *SimWatch(void *arg)
+{
+    unsigned seen = __atomic_load_n(&Sim->inputSeq, __ATOMIC_ACQUIRE), now;
+    unsigned long long one = 1;
+
+    if(Realtime) RtPrefaultStack();
+    for(;;) {
+        syscall(SYS_futex, &Sim->inputSeq, FUTEX_WAIT, seen, NULL, NULL, 0);
+        now = __atomic_load_n(&Sim->inputSeq, __ATOMIC_ACQUIRE);
+        if(now == seen) continue;
+        seen = now;
+        // EAGAIN means the count is saturated, which wakes the reader
+        // just the same.
+        if(write(EventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) break;
+    }
+    return NULL;
+}
+
+static int SimEventFd(int priority)
+{
+    pthread_attr_t attr;
+    int err;
+
+    EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(EventFd < 0) {
+        perror("eventfd");
+        exit(-1);
+    }
+    RtThreadAttr(&attr, Realtime ? priority : 0, RtCpu);
+    if((err = pthread_create(&Watcher, &attr, SimWatch, NULL)) != 0) {
+        fprintf(stderr, "sim: couldn't start watcher thread: %s\n",
+            strerror(err));
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    return EventFd;
+}
+
+static long long SimTakeEdge(void)
+{
+    unsigned long long count;
+
+    // Just to clear the eventfd; the time of the edge is in the image.
+    if(EventFd >= 0) (void)read(EventFd, &count, sizeof(count));
+    return __atomic_exchange_n(&Sim->inputTime, 0, __ATOMIC_ACQ_REL);
+}
+
+IoBackend SimBackend = {
+    "sim",
+    IO_CAP_INPUTS | IO_CAP_OUTPUTS | IO_CAP_BULK | IO_CAP_SIMULATED |
+        IO_CAP_EDGES,
+    SimInit,
+    SimReadInputs,
+    SimWriteOutputs,
+    SimEventFd,
+    SimTakeEdge,
+};
@@ -0,0 +1,227 @@
+//-----------------------------------------------------------------------------
+// The remote I/O backend for ldpi: the pins are on another box on the
+// network, and every scan exchanges one UDP datagram each way with it
+// (ldpiudp.h), however many pins there are. Use it with
+//
+//      --io=udp:host[:port][,timeout=ms][,hold]
+//
+// (port 5020 by default). At the end of each scan the outputs go out in one
+// frame, and the node answers at once with its inputs, which the next scan
+// picks up without waiting; so the inputs are at most one scan old, and the
+// scan never blocks on the network. If no answer has come for timeout ms
+// (100 by default) the inputs read as off, or with hold, keep their last
+// values, until the node is heard from again; the node itself turns its
+// outputs off if it stops hearing from ldpi.
+//
+// The round trip, from sending the outputs to the kernel receiving the
+// answer (by its own timestamp, so that it doesn't include the wait for the
+// next scan), is kept in UdpRoundTrip, for the scan statistics.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "io.h"
+#include "rt.h"
+#include "ldpiudp.h"
+
+// How many frames back an answer can be and still be timed.
+#define SENT_RING               64
+
+Histogram UdpRoundTrip;
+unsigned long long UdpSent, UdpReceived, UdpLost, UdpLate;
+unsigned long UdpTimeouts;
+
+static int Fd = -1;
+static char Node[128];
+static long long Timeout = 100000000LL;     // ns
+static int Hold;
+
+static LdpiUdpFrame Out;
+static unsigned Seq, Answered;      // the last frame sent, and answered
+static struct timespec Sent[SENT_RING];     // CLOCK_REALTIME
+static IoWord Inputs[IO_WORDS], InputPinsHere[IO_WORDS];
+static long long LastHeard;         // CLOCK_MONOTONIC ns
+static int Down;
+
+static long long Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void UdpInit(const char *args, const IoWord *inputs,
+    const IoWord *outputs)
+{
+    struct addrinfo hints, *ai;
+    char buf[128], host[128] = "", port[16], *p, *colon;
+    int one = 1, i, err;
+
+    snprintf(port, sizeof(port), "%d", LDPI_UDP_PORT);
+    if(args) {
+        strncpy(buf, args, sizeof(buf) - 1);
+        buf[sizeof(buf) - 1] = '\0';
+        for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+            if(strncmp(p, "timeout=", 8) == 0) {
+                Timeout = atol(p + 8)*1000000LL;
+            } else if(strcmp(p, "hold") == 0) {
+                Hold = 1;
+            } else if(*p) {
+                if((colon = strchr(p, ':'))) {
+                    *colon = '\0';
+                    snprintf(port, sizeof(port), "%s", colon + 1);
+                }
+                snprintf(host, sizeof(host), "%s", p);
+            }
+        }
+    }
+    if(!host[0]) {
+        fprintf(stderr, "udp: which node? (--io=udp:host[:port])\n");
+        exit(-1);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if((err = getaddrinfo(host, port, &hints, &ai)) != 0) {
+        fprintf(stderr, "udp: %s: %s\n", host, gai_strerror(err));
+        exit(-1);
+    }
+    Fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // Only the node can then send us anything.
+    if(Fd < 0 || connect(Fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+        perror("udp");
+        exit(-1);
+    }
+    freeaddrinfo(ai);
+    setsockopt(Fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+    snprintf(Node, sizeof(Node), "%s:%s", host, port);
+
+    memset(&Out, 0, sizeof(Out));
+    Out.magic = htonl(LDPI_UDP_MAGIC);
+    Out.version = htons(LDPI_UDP_VERSION);
+    Out.type = htons(LDPI_UDP_OUTPUTS);
+    for(i = 0; i < IO_WORDS && i < LDPI_UDP_WORDS; i++) {
+        Out.outputPins[i] = htonl(outputs[i]);
+        Out.inputPins[i] = htonl(inputs[i]);
+        InputPinsHere[i] = inputs[i];
+    }
+    LastHeard = Now();
+    printf("\tremote I/O node at %s, timeout %lld ms%s\n", Node,
+        Timeout/1000000, Hold ? ", inputs held" : "");
+}
+
+// Take the newest answer waiting, if any.
+static void Receive(void)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct timespec rx, *sent;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+    LdpiUdpFrame f;
+    unsigned seq;
+    int n, i;
+
+    for(;;) {
+        iov.iov_base = &f;
+        iov.iov_len = sizeof(f);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        n = recvmsg(Fd, &msg, MSG_DONTWAIT);
+        if(n < 0) {
+            // ECONNREFUSED: the node isn't there (yet); the timeout copes.
+            if(errno == EINTR || errno == ECONNREFUSED) continue;
+            return;
+        }
+        if(n != sizeof(f) || ntohl(f.magic) != LDPI_UDP_MAGIC ||
+            ntohs(f.type) != LDPI_UDP_INPUTS)
+        {
+            continue;
+        }
+        seq = ntohl(f.seq);
+        if((int)(seq - Answered) <= 0 || (int)(seq - Seq) > 0) {
+            UdpLate++;
+            continue;
+        }
+        UdpReceived++;
+        UdpLost += seq - Answered - 1;
+        Answered = seq;
+
+        for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(cm->cmsg_level != SOL_SOCKET ||
+                cm->cmsg_type != SCM_TIMESTAMPNS)
+            {
+                continue;
+            }
+            memcpy(&rx, CMSG_DATA(cm), sizeof(rx));
+            sent = &Sent[seq % SENT_RING];
+            if(Seq - seq < SENT_RING) {
+                HistRecord(&UdpRoundTrip, TimespecDiffNs(&rx, sent));
+            }
+        }
+
+        for(i = 0; i < IO_WORDS; i++) {
+            Inputs[i] = (i < LDPI_UDP_WORDS ? ntohl(f.pins[i]) : 0) &
+                InputPinsHere[i];
+        }
+        if(ntohl(f.flags) & LDPI_UDP_SAFE) {
+            LogPrintf("udp: %s had stopped hearing from us, and turned its "
+                "outputs off\n", Node);
+        }
+        LastHeard = Now();
+    }
+}
+
+static void UdpReadInputs(IoWord *image)
+{
+    Receive();
+    if(Now() - LastHeard > Timeout) {
+        if(!Down) {
+            Down = 1;
+            UdpTimeouts++;
+            LogPrintf("udp: no answer from %s for %lld ms; inputs %s\n", Node,
+                Timeout/1000000, Hold ? "held" : "off");
+        }
+        if(!Hold) memset(Inputs, 0, sizeof(Inputs));
+    } else if(Down) {
+        Down = 0;
+        LogPrintf("udp: %s answering again\n", Node);
+    }
+    memcpy(image, Inputs, IO_WORDS*sizeof(IoWord));
+}
+
+// Called at the end of every scan (IO_CAP_CYCLIC), changed or not.
+static void UdpWriteOutputs(const IoWord *image, const IoWord *changed)
+{
+    int i;
+
+    for(i = 0; i < IO_WORDS && i < LDPI_UDP_WORDS; i++) {
+        unsigned v = ntohl(Out.pins[i]);
+        Out.pins[i] = htonl((v & ~changed[i]) | (image[i] & changed[i]));
+    }
+    Out.seq = htonl(++Seq);
+    clock_gettime(CLOCK_REALTIME, &Sent[Seq % SENT_RING]);
+    // A full socket buffer just loses the frame, as the network might.
+    if(send(Fd, &Out, sizeof(Out), MSG_DONTWAIT) == sizeof(Out)) UdpSent++;
+}
+
+IoBackend UdpBackend = {
+    "udp",
+    IO_CAP_INPUTS | IO_CAP_OUTPUTS | IO_CAP_BULK | IO_CAP_CYCLIC,
+    UdpInit,
+    UdpReadInputs,
+    UdpWriteOutputs,
+    NULL,
+    NULL,
+};
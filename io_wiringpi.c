@@ -0,0 +1,60 @@
+//-----------------------------------------------------------------------------
+// The wiringPi I/O backend for ldpi: pin n is wiringPi pin n.
+//-----------------------------------------------------------------------------
+#include <string.h>
+#include <wiringPi.h>
+
+#include "io.h"
+
+// The input pins, as a list, so that reading them costs only as many
+// digitalRead()s as there are inputs.
+static int InPin[MAX_PINS], InCount;
+
+static void initPins(const char *args, const IoWord *inputs,
+    const IoWord *outputs)
+{
+	int pin;
+
+	wiringPiSetup();
+	for (pin = 0; pin < MAX_PINS; pin++) {
+		if (IO_GET(inputs, pin)) {
+			pinMode(pin, INPUT);
+			InPin[InCount++] = pin;
+		}
+		else if (IO_GET(outputs, pin)) pinMode(pin, OUTPUT);
+	}
+}
+
+static void getInputs(IoWord *image)
+{
+	int i;
+
+	memset(image, 0, IO_WORDS*sizeof(IoWord));
+	for (i = 0; i < InCount; i++) {
+		if (digitalRead(InPin[i])) IO_SET(image, InPin[i], 1);
+	}
+}
+
+// Only the changed pins are visited, lowest set bit first.
+static void setOutputs(const IoWord *image, const IoWord *changed)
+{
+	IoWord m;
+	int w, pin;
+
+	for (w = 0; w < IO_WORDS; w++) {
+		for (m = changed[w]; m; m &= m - 1) {
+			pin = w*IO_WORD_BITS + __builtin_ctz(m);
+			digitalWrite(pin, IO_GET(image, pin));
+		}
+	}
+}
+
+IoBackend WiringPiBackend = {
+    "wiringpi",
+    IO_CAP_INPUTS | IO_CAP_OUTPUTS,
+    initPins,
+    getInputs,
+    setOutputs,
+    NULL,
+    NULL,
+};
@@ -43,13 +43,15 @@
 // Write your ladder in ldmicro, compile it to interpretable byte code,  scp 
 // it to your RPi, and run it with:
 // $ sudo ./ldpi xxx.int
-// Use GPIx and GPOx for your contact and coil names, respectively.  Only
-// the GPIO1-7 pins are supported in this initial version.
+// Use GPIx and GPOx for your contact and coil names, respectively, for x
+// up to 63, or give the pins your own names with a --map file.
 //
 // To build, you need to first get, compile, and install wiringPi, see 
 // https://projects.drogon.net/raspberry-pi/wiringpi/
 // Then, just:
 // $ make
+// or, to build without wiringPi (with only the simulated I/O):
+// $ make WIRINGPI=0
 // 
 // Glenn Butcher, March 2013
 //-----------------------------------------------------------------------------
@@ -58,53 +60,59 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #define INTCODE_H_CONSTANTS_ONLY
 #include "intcode.h"
-#include <wiringPi.h>
-
-typedef unsigned char BYTE;     // 8-bit unsigned
-typedef unsigned short WORD;    // 16-bit unsigned
-typedef signed short SWORD;     // 16-bit signed
-
-// Some arbitrary limits on the program and data size
-#define MAX_OPS                 1024
-#define MAX_VARIABLES           128
-#define MAX_INTERNAL_RELAYS     128
-
-// This data structure represents a single instruction for the 'virtual
-// machine.' The .op field gives the opcode, and the other fields give
-// arguments. I have defined all of these as 16-bit fields for generality,
-// but if you want then you can crunch them down to 8-bit fields (and
-// limit yourself to 256 of each type of variable, of course). If you
-// crunch down .op then nothing bad happens at all. If you crunch down
-// .literal then you only have 8-bit literals now (so you can't move
-// 300 into 'var'). If you crunch down .name3 then that limits your code size,
-// because that is the field used to encode the jump addresses.
-// 
-// A more compact encoding is very possible if space is a problem for
-// you. You will probably need some kind of translator regardless, though,
-// to put it in whatever format you're going to pack in flash or whatever,
-// and also to pick out the name <-> address mappings for those variables
-// that you're going to use for your interface out. I will therefore leave
-// that up to you.
-typedef struct {
-    WORD    op;
-    WORD    name1;
-    WORD    name2;
-    WORD    name3;
-    SWORD   literal;
-} BinOp;
-
-BinOp Program[MAX_OPS];
-SWORD Integers[MAX_VARIABLES];
-BYTE Bits[MAX_INTERNAL_RELAYS];
-
-// This are addresses (indices into Integers[] or Bits[]) used so that your
-// C code can get at some of the ladder variables, by remembering the
-// mapping between some ladder names and their addresses.
-int GPI0, GPI1, GPI2, GPI3, GPI4, GPI5, GPI6, GPI7;
-int GPO0, GPO1, GPO2, GPO3, GPO4, GPO5, GPO6, GPO7;
+#include "ldpi.h"
+#include "rt.h"
+#include "pipeline.h"
+#include "io.h"
+#include "react.h"
+#include "modbus.h"
+#include "image.h"
+#include "command.h"
+#include "stream.h"
+#include "adc.h"
+#include "pwm.h"
+#include "uart.h"
+#include "eeprom.h"
+#include "retain.h"
+#include "profile.h"
+
+Task Tasks[MAX_TASKS];
+int NumTasks;
+
+// The process image that the tasks share: the state of the I/O pins, one
+// bit per pin, and the current value of every variable that is
+// exchanged between tasks. A task copies what it needs in at the start of
+// its scan and copies what it wrote out at the end, holding ImageLock (which
+// does priority inheritance, so a slow task that holds it is boosted past
+// anything of middle priority) just long enough to copy.
+IoWord InputImage[IO_WORDS];
+IoWord OutputImage[IO_WORDS];
+IoWord InputPins[IO_WORDS];
+IoWord OutputPins[IO_WORDS];
+char SharedNames[MAX_SHARED][MAX_SYMBOL_LEN];
+SWORD SharedValues[MAX_SHARED];
+int SharedCount;
+pthread_mutex_t ImageLock;
+
+// Cleared by SIGINT or SIGTERM to stop the scan threads.
+volatile int Running = 1;
+
+// All of the scan threads are released from the same moment, so that their
+// schedules line up.
+struct timespec StartTime;
+
+// How often (in seconds) to print a summary of the scan statistics; a full
+// report is printed on SIGUSR1, and at exit.
+int StatsInterval;
+volatile int StatsRequested;
 
 //-----------------------------------------------------------------------------
 // What follows are just routines to load the program, which I represent as
@@ -130,23 +138,24 @@ int HexDigit(int c)
     return 0;
 }
 
-void LoadProgram(char *fileName)
+void LoadProgram(Task *task, const char *fileName)
 {
     printf("Starting program...\n");
-    int pc;
+    int pc, isInt = 0;
     FILE *f = fopen(fileName, "r");
     char line[80];    // This is not suitable for untrusted input.
+    BinOp *Program = task->program;
 
     if(!f) {
-        fprintf(stderr, "couldn't open '%s'\n", f);
+        fprintf(stderr, "couldn't open '%s'\n", fileName);
         exit(-1);
     }
 
     if(!fgets(line, sizeof(line), f)) BadFormat("first fgets");
     if(!strstr(line, "$$LDcode")) BadFormat(line);
 
-    GPI0=-1; GPI1=-1; GPI2=-1; GPI3=-1; GPI4=-1; GPI5=-1; GPI6=-1; GPI7=-1;
-    GPO0=-1; GPO1=-1; GPO2=-1; GPO3=-1; GPO4=-1; GPO5=-1; GPO6=-1; GPO7=-1;
+    task->fileName = fileName;
+    task->cycleTime = 0;
 
     printf("\tloading code...\n");
     for(pc = 0; ; pc++) {
@@ -155,6 +164,7 @@ void LoadProgram(char *fileName)
 
         if(!fgets(line, sizeof(line), f)) BadFormat(line);
         if(strstr(line, "$$bits")) break;
+        if(pc >= MAX_OPS) BadFormat("program too long");
         //if(strlen(line) != sizeof(BinOp)*2 + 2) BadFormat("bad sizeof");
 
         t = line;
@@ -166,149 +176,444 @@ void LoadProgram(char *fileName)
         }
     }
 
+    // The bits come first, then the integers after a $$int16s line, then
+    // the cycle time.
     char *symbol, *addr;
     printf("\tloading symbols...\n");
     while(fgets(line, sizeof(line), f)) {
-        symbol =strtok(line,",");
-        addr = strtok(NULL, ",\r\n");
-        printf("\t\tsymbol: %s, addr: %s\n", symbol, addr);
-        if(strstr(symbol, "GPI0")) GPI0 = atoi(addr);
-        if(strstr(symbol, "GPI1")) GPI1 = atoi(addr);
-        if(strstr(symbol, "GPI2")) GPI2 = atoi(addr);
-        if(strstr(symbol, "GPI3")) GPI3 = atoi(addr);
-        if(strstr(symbol, "GPI4")) GPI4 = atoi(addr);
-        if(strstr(symbol, "GPI5")) GPI5 = atoi(addr);
-        if(strstr(symbol, "GPI6")) GPI6 = atoi(addr);
-        if(strstr(symbol, "GPI7")) GPI7 = atoi(addr);
-        
-        if(strstr(symbol, "GPO0")) GPO0 = atoi(addr);
-        if(strstr(symbol, "GPO1")) GPO1 = atoi(addr);
-        if(strstr(symbol, "GPO2")) GPO2 = atoi(addr);
-        if(strstr(symbol, "GPO3")) GPO3 = atoi(addr);
-        if(strstr(symbol, "GPO4")) GPO4 = atoi(addr);
-        if(strstr(symbol, "GPO5")) GPO5 = atoi(addr);
-        if(strstr(symbol, "GPO6")) GPO6 = atoi(addr);
-        if(strstr(symbol, "GPO7")) GPO7 = atoi(addr);
-        
+        Symbol *sym;
+        int pin, output;
+
+        if(strstr(line, "$$int16s")) {
+            isInt = 1;
+            continue;
+        }
         if(strstr(line, "$$cycle")) {
-            int cycle = atoi(line + 7);
-            if(cycle != 10*1000) {
-                fprintf(stderr, "cycle time was not 10 ms when compiled; "
-                    "please fix that. (%d)\n",cycle);
+            task->cycleTime = atol(line + 7);
+            if(task->cycleTime <= 0) {
+                fprintf(stderr, "bad cycle time in program (%ld)\n",
+                    task->cycleTime);
                 exit(-1);
             }
+            continue;
+        }
+
+        symbol =strtok(line,",");
+        addr = strtok(NULL, ",\r\n");
+        if(!symbol || !addr) continue;
+        printf("\t\tsymbol: %s, addr: %s\n", symbol, addr);
+
+        if(task->symbolCount >= MAX_SYMBOLS) BadFormat("too many symbols");
+        sym = &task->symbols[task->symbolCount++];
+        strncpy(sym->name, symbol, sizeof(sym->name) - 1);
+        sym->addr = atoi(addr);
+        sym->isInt = isInt;
+        if(sym->addr >= (isInt ? MAX_VARIABLES : MAX_INTERNAL_RELAYS)) {
+            BadFormat("address out of range");
+        }
+        if(isInt) continue;
+
+        if((pin = IoPinOf(sym->name, &output)) < 0) continue;
+        if(pin >= MAX_PINS) BadFormat("pin number too big");
+        if(output) {
+            task->outputs[task->outputCount].pin = pin;
+            task->outputs[task->outputCount++].addr = sym->addr;
+        } else {
+            task->inputs[task->inputCount].pin = pin;
+            task->inputs[task->inputCount++].addr = sym->addr;
         }
     }
 
     fclose(f);
-}
-//-----------------------------------------------------------------------------
 
+    if(task->cycleTime <= 0) BadFormat("no $$cycle");
+
+    // A READ ADC or SET PWM only names the variable that it reads into or
+    // takes the duty cycle from; the channel comes from that variable's
+    // name, and goes in a field that the op doesn't use (name2 for READ
+    // ADC, name3 for SET PWM, whose name2 is its frequency), so that the
+    // instruction can go straight to it.
+    for(pc = 0; pc < MAX_OPS && Program[pc].op != INT_END_OF_PROGRAM; pc++) {
+        BinOp *p = &Program[pc];
+        int k, channel = -1, adc = (p->op == INT_READ_ADC);
+
+        if(p->op == INT_UART_SEND || p->op == INT_UART_RECV) UartUse(task);
+        if(p->op == INT_EEPROM_READ || p->op == INT_EEPROM_WRITE) {
+            if(p->literal < 0 || p->literal >= EEPROM_SIZE ||
+                (p->literal & 1))
+            {
+                BadFormat("EEPROM address");
+            }
+            EepromUsed = 1;
+        }
+        if(p->op == INT_EEPROM_BUSY_CHECK) EepromUsed = 1;
+        if(p->op != INT_READ_ADC && p->op != INT_SET_PWM) continue;
+        for(k = 0; k < task->symbolCount && channel < 0; k++) {
+            Symbol *sym = &task->symbols[k];
+            if(sym->isInt && sym->addr == p->name1) {
+                channel = adc ? AdcChannelOf(sym->name) :
+                    PwmChannelOf(sym->name);
+            }
+        }
+        if(channel < 0) {
+            fprintf(stderr, "%s: %s int16s[%d], which has no %sn in its "
+                "name\n", fileName, adc ? "READ ADC into" : "SET PWM from",
+                p->name1, adc ? "ADC" : "PWM");
+            exit(-1);
+        }
+        if(adc) {
+            p->name2 = channel;
+            AdcUse(channel);
+        } else {
+            p->name3 = channel;
+            PwmUse(task, channel, p->name2);
+        }
+    }
+    printf("\tcycle time: %ld us\n", task->cycleTime);
+}
 
 //-----------------------------------------------------------------------------
-// Disassemble the program and pretty-print it. This is just for debugging,
-// and it is also the only documentation for what each op does. The bit
-// variables (internal relays or whatever) live in a separate space from the
-// integer variables; I refer to those as bits[addr] and int16s[addr]
-// respectively.
+// Work out which of the variables in Bits[] and Integers[] the program
+// writes; a variable that is shared between tasks may only be written by
+// one of them.
 //-----------------------------------------------------------------------------
-void Disassemble(void)
+void MarkWrites(const Task *t, BYTE *bitsWritten, BYTE *intsWritten)
 {
     int pc;
-    for(pc = 0; ; pc++) {
-        BinOp *p = &Program[pc];
-        printf("%03x: ", pc);
+    for(pc = 0; pc < MAX_OPS; pc++) {
+        const BinOp *p = &t->program[pc];
 
-        switch(Program[pc].op) {
+        switch(p->op) {
             case INT_SET_BIT:
-                printf("bits[%03x] := 1", p->name1);
-                break;
-
             case INT_CLEAR_BIT:
-                printf("bits[%03x] := 0", p->name1);
+            case INT_COPY_BIT_TO_BIT:
+                bitsWritten[p->name1] = 1;
                 break;
 
-            case INT_COPY_BIT_TO_BIT:
-                printf("bits[%03x] := bits[%03x]", p->name1, p->name2);
+            case INT_EEPROM_BUSY_CHECK:
+                bitsWritten[p->name1] = 1;
                 break;
 
-            case INT_SET_VARIABLE_TO_LITERAL:
-                printf("int16s[%03x] := %d (0x%04x)", p->name1, p->literal,
-                    p->literal);
+            case INT_EEPROM_READ:
+                intsWritten[p->name1] = 1;
                 break;
 
-            case INT_SET_VARIABLE_TO_VARIABLE:
-                printf("int16s[%03x] := int16s[%03x]", p->name1, p->name2);
+            case INT_UART_RECV:
+                intsWritten[p->name1] = 1;
+                // fall through
+            case INT_UART_SEND:
+                bitsWritten[p->name2] = 1;
                 break;
 
+            case INT_SET_VARIABLE_TO_LITERAL:
+            case INT_SET_VARIABLE_TO_VARIABLE:
             case INT_INCREMENT_VARIABLE:
-                printf("(int16s[%03x])++", p->name1);
+            case INT_SET_VARIABLE_ADD:
+            case INT_SET_VARIABLE_SUBTRACT:
+            case INT_SET_VARIABLE_MULTIPLY:
+            case INT_SET_VARIABLE_DIVIDE:
+            case INT_READ_ADC:
+                intsWritten[p->name1] = 1;
                 break;
 
-            {
-                char c;
-                case INT_SET_VARIABLE_ADD: c = '+'; goto arith;
-                case INT_SET_VARIABLE_SUBTRACT: c = '-'; goto arith;
-                case INT_SET_VARIABLE_MULTIPLY: c = '*'; goto arith;
-                case INT_SET_VARIABLE_DIVIDE: c = '/'; goto arith;
-arith:
-                    printf("int16s[%03x] := int16s[%03x] %c int16s[%03x]",
-                        p->name1, p->name2, c, p->name3);
-                    break;
+            case INT_END_OF_PROGRAM:
+                return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Once all of the programs are loaded, tie them together: sort the tasks
+// rate-monotonically (shortest period first, which is also the order of
+// their priorities), make the fastest one responsible for the physical I/O,
+// and find the variables that they share by name.
+//-----------------------------------------------------------------------------
+int FindShared(const char *name)
+{
+    int i;
+    for(i = 0; i < SharedCount; i++) {
+        if(strcmp(SharedNames[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+void LinkTasks(void)
+{
+    static BYTE bitsWritten[MAX_TASKS][MAX_INTERNAL_RELAYS];
+    static BYTE intsWritten[MAX_TASKS][MAX_VARIABLES];
+    static int writer[MAX_SHARED];
+    static int driver[MAX_PINS];
+    int i, j, k;
+
+    // A stable insertion sort, so that tasks with the same period keep the
+    // order they were given in.
+    for(i = 1; i < NumTasks; i++) {
+        static Task tmp;
+        for(j = i; j > 0 && Tasks[j-1].cycleTime > Tasks[i].cycleTime; j--)
+            ;
+        if(j == i) continue;
+        memcpy(&tmp, &Tasks[i], sizeof(Task));
+        memmove(&Tasks[j+1], &Tasks[j], (i - j)*sizeof(Task));
+        memcpy(&Tasks[j], &tmp, sizeof(Task));
+    }
+
+    for(i = 0; i < NumTasks; i++) {
+        Tasks[i].io = (i == 0);
+        Tasks[i].priority = RtPriority - i;
+        if(Tasks[i].priority < 1) Tasks[i].priority = 1;
+        MarkWrites(&Tasks[i], bitsWritten[i], intsWritten[i]);
+    }
+
+    // Each output pin may be driven by only one task.
+    for(k = 0; k < MAX_PINS; k++) driver[k] = -1;
+    for(i = 0; i < NumTasks; i++) {
+        for(k = 0; k < Tasks[i].outputCount; k++) {
+            int pin = Tasks[i].outputs[k].pin;
+            if(driver[pin] >= 0 && driver[pin] != i) {
+                fprintf(stderr, "GPO%d is driven by both %s and %s\n",
+                    pin, Tasks[driver[pin]].fileName, Tasks[i].fileName);
+                exit(-1);
             }
+            driver[pin] = i;
+        }
+    }
 
-            case INT_IF_BIT_SET:
-                printf("unless (bits[%03x] set)", p->name1);
-                goto cond;
-            case INT_IF_BIT_CLEAR:
-                printf("unless (bits[%03x] clear)", p->name1);
-                goto cond;
-            case INT_IF_VARIABLE_LES_LITERAL:
-                printf("unless (int16s[%03x] < %d)", p->name1, p->literal);
-                goto cond;
-            case INT_IF_VARIABLE_EQUALS_VARIABLE:
-                printf("unless (int16s[%03x] == int16s[%03x])", p->name1,
-                    p->name2);
-                goto cond;
-            case INT_IF_VARIABLE_GRT_VARIABLE:
-                printf("unless (int16s[%03x] > int16s[%03x])", p->name1,
-                    p->name2);
-                goto cond;
-cond:
-                printf(" jump %03x+1", p->name3);
-                break;
+    // Any other name that appears in more than one program is shared.
+    for(i = 0; i < NumTasks; i++) {
+        for(k = 0; k < Tasks[i].symbolCount; k++) {
+            Symbol *sym = &Tasks[i].symbols[k];
+            int slot, output, found = 0;
 
-            case INT_ELSE:
-                printf("jump %03x+1", p->name3);
-                break;
+            // The pins are shared through the I/O image instead.
+            if(!sym->isInt && IoPinOf(sym->name, &output) >= 0) continue;
+            for(j = 0; j < NumTasks; j++) {
+                int m;
+                if(j == i) continue;
+                for(m = 0; m < Tasks[j].symbolCount; m++) {
+                    if(strcmp(Tasks[j].symbols[m].name, sym->name) == 0) {
+                        if(Tasks[j].symbols[m].isInt != sym->isInt) {
+                            fprintf(stderr, "'%s' is a bit in one program "
+                                "and an integer in another\n", sym->name);
+                            exit(-1);
+                        }
+                        found = 1;
+                    }
+                }
+            }
+            if(!found) continue;
 
-            case INT_END_OF_PROGRAM:
-                printf("<end of program>\n");
-                return;
+            slot = FindShared(sym->name);
+            if(slot < 0) {
+                if(SharedCount >= MAX_SHARED) BadFormat("too many shared");
+                slot = SharedCount++;
+                strcpy(SharedNames[slot], sym->name);
+                writer[slot] = -1;
+            }
 
-            default:
-                BadFormat("disassemble");
+            SharedRef *r = &Tasks[i].shared[Tasks[i].sharedCount++];
+            r->addr = sym->addr;
+            r->slot = slot;
+            r->isInt = sym->isInt;
+            r->writer = sym->isInt ? intsWritten[i][sym->addr] :
+                bitsWritten[i][sym->addr];
+            if(r->writer) {
+                if(writer[slot] >= 0) {
+                    fprintf(stderr, "'%s' is written by both %s and %s\n",
+                        sym->name, Tasks[writer[slot]].fileName,
+                        Tasks[i].fileName);
+                    exit(-1);
+                }
+                writer[slot] = i;
+            }
+        }
+    }
+
+    for(i = 0; i < SharedCount; i++) {
+        printf("shared: %s, written by %s\n", SharedNames[i],
+            writer[i] >= 0 ? Tasks[writer[i]].fileName : "nobody");
+    }
+
+    // A pin that one task uses as an input and another as an output is an
+    // input.
+    for(i = 0; i < NumTasks; i++) {
+        for(k = 0; k < Tasks[i].inputCount; k++) {
+            IO_SET(InputPins, Tasks[i].inputs[k].pin, 1);
+        }
+        for(k = 0; k < Tasks[i].outputCount; k++) {
+            IO_SET(OutputPins, Tasks[i].outputs[k].pin, 1);
+        }
+    }
+    for(k = 0; k < IO_WORDS; k++) OutputPins[k] &= ~InputPins[k];
+}
+//-----------------------------------------------------------------------------
+
+
+//-----------------------------------------------------------------------------
+// Disassemble the program and pretty-print it. This is just for debugging,
+// and it is also the only documentation for what each op does. The bit
+// variables (internal relays or whatever) live in a separate space from the
+// integer variables; I refer to those as bits[addr] and int16s[addr]
+// respectively.
+//
+// DisassembleOp() prints just the one instruction, without a newline, so
+// that the profile (see profile.c) can list them in its own order.
+//-----------------------------------------------------------------------------
+void DisassembleOp(const BinOp *p)
+{
+    switch(p->op) {
+        case INT_SET_BIT:
+            printf("bits[%03x] := 1", p->name1);
+            break;
+
+        case INT_CLEAR_BIT:
+            printf("bits[%03x] := 0", p->name1);
+            break;
+
+        case INT_COPY_BIT_TO_BIT:
+            printf("bits[%03x] := bits[%03x]", p->name1, p->name2);
+            break;
+
+        case INT_SET_VARIABLE_TO_LITERAL:
+            printf("int16s[%03x] := %d (0x%04x)", p->name1, p->literal,
+                p->literal);
+            break;
+
+        case INT_SET_VARIABLE_TO_VARIABLE:
+            printf("int16s[%03x] := int16s[%03x]", p->name1, p->name2);
+            break;
+
+        case INT_INCREMENT_VARIABLE:
+            printf("(int16s[%03x])++", p->name1);
+            break;
+
+        {
+            char c;
+            case INT_SET_VARIABLE_ADD: c = '+'; goto arith;
+            case INT_SET_VARIABLE_SUBTRACT: c = '-'; goto arith;
+            case INT_SET_VARIABLE_MULTIPLY: c = '*'; goto arith;
+            case INT_SET_VARIABLE_DIVIDE: c = '/'; goto arith;
+arith:
+                printf("int16s[%03x] := int16s[%03x] %c int16s[%03x]",
+                    p->name1, p->name2, c, p->name3);
                 break;
         }
+
+        case INT_READ_ADC:
+            printf("int16s[%03x] := adc[%d]", p->name1, p->name2);
+            break;
+
+        case INT_SET_PWM:
+            printf("pwm[%d] := int16s[%03x] %%", p->name3, p->name1);
+            if(p->name2) printf(" at %d Hz", p->name2);
+            break;
+
+        case INT_UART_SEND:
+            printf("if (bits[%03x]) uart send int16s[%03x]; "
+                "bits[%03x] := uart busy", p->name2, p->name1, p->name2);
+            break;
+
+        case INT_UART_RECV:
+            printf("bits[%03x] := uart recv into int16s[%03x]", p->name2,
+                p->name1);
+            break;
+
+        case INT_EEPROM_BUSY_CHECK:
+            printf("bits[%03x] := eeprom busy", p->name1);
+            break;
+
+        case INT_EEPROM_READ:
+            printf("int16s[%03x] := eeprom[%03x]", p->name1, p->literal);
+            break;
+
+        case INT_EEPROM_WRITE:
+            printf("eeprom[%03x] := int16s[%03x]", p->literal, p->name1);
+            break;
+
+        case INT_IF_BIT_SET:
+            printf("unless (bits[%03x] set)", p->name1);
+            goto cond;
+        case INT_IF_BIT_CLEAR:
+            printf("unless (bits[%03x] clear)", p->name1);
+            goto cond;
+        case INT_IF_VARIABLE_LES_LITERAL:
+            printf("unless (int16s[%03x] < %d)", p->name1, p->literal);
+            goto cond;
+        case INT_IF_VARIABLE_EQUALS_VARIABLE:
+            printf("unless (int16s[%03x] == int16s[%03x])", p->name1,
+                p->name2);
+            goto cond;
+        case INT_IF_VARIABLE_GRT_VARIABLE:
+            printf("unless (int16s[%03x] > int16s[%03x])", p->name1,
+                p->name2);
+            goto cond;
+cond:
+            printf(" jump %03x+1", p->name3);
+            break;
+
+        case INT_ELSE:
+            printf("jump %03x+1", p->name3);
+            break;
+
+        case INT_END_OF_PROGRAM:
+            printf("<end of program>");
+            break;
+
+        default:
+            BadFormat("disassemble");
+            break;
+    }
+}
+
+void Disassemble(const Task *t)
+{
+    int pc;
+
+    printf("%s:\n", t->fileName);
+    for(pc = 0; ; pc++) {
+        printf("%03x: ", pc);
+        DisassembleOp(&t->program[pc]);
         printf("\n");
+        if(t->program[pc].op == INT_END_OF_PROGRAM) break;
     }
 }
 
 //-----------------------------------------------------------------------------
-// This is the actual interpreter. It runs the program, and needs no state
-// other than that kept in Bits[] and Integers[]. If you specified a cycle
+// This is the actual interpreter. It runs the task's program, and needs no
+// state other than the task's Bits[] and Integers[]. If you specified a cycle
 // time of 10 ms when you compiled the program, then you would have to
 // call this function 100 times per second for the timing to be correct.
 //
 // The execution time of this function depends mostly on the length of the
 // program. It will be a little bit data-dependent but not very.
+//
+// It is compiled twice: as InterpretOneCycle(), and, with profile set, as
+// InterpretProfiled(), which also counts each instruction and times each
+// rung for --profile. profile is a constant in each, so the counting is
+// simply not there in the first one.
 //-----------------------------------------------------------------------------
-void InterpretOneCycle(void)
+static inline __attribute__((always_inline)) void Interpret(Task *t,
+    const int profile)
 {
-    int pc;
+    BinOp *Program = t->program;
+    SWORD *Integers = t->integers;
+    BYTE *Bits = t->bits;
+    Profile *prof = t->profile;
+    unsigned long long last = 0, now;
+    int pc, c, rung = 0;
+
+    if(profile) last = ProfileTicks();
     for(pc = 0; ; pc++) {
         BinOp *p = &Program[pc];
 
+        if(profile) {
+            prof->count[pc]++;
+            if(prof->rungStart[pc]) {
+                now = ProfileTicks();
+                prof->ticks[rung] += now - last;
+                last = now;
+                rung = prof->rungOf[pc];
+            }
+        }
         switch(Program[pc].op) {
             case INT_SET_BIT:
                 Bits[p->name1] = 1;
@@ -353,6 +658,47 @@ void InterpretOneCycle(void)
                 }
                 break;
 
+            // The sampling thread keeps the reading up to date; see adc.c.
+            case INT_READ_ADC:
+                Integers[p->name1] = __atomic_load_n(&AdcValues[p->name2],
+                    __ATOMIC_RELAXED);
+                break;
+
+            // Written out (if it changed) with the outputs; see pwm.c.
+            case INT_SET_PWM:
+                t->pwm[p->name3] = Integers[p->name1] < 0 ? 0 :
+                    (Integers[p->name1] > 100 ? 100 : Integers[p->name1]);
+                break;
+
+            // LDmicro's semantics, through the ring buffers of uart.c: the
+            // bit says to send, and comes back set while the UART is busy;
+            // or it says that a character came in.
+            case INT_UART_SEND:
+                if(Bits[p->name2]) UartSend((BYTE)Integers[p->name1]);
+                Bits[p->name2] = UartBusy();
+                break;
+
+            case INT_UART_RECV:
+                if((c = UartRecv()) >= 0) Integers[p->name1] = c;
+                Bits[p->name2] = (c >= 0);
+                break;
+
+            // The EEPROM is in memory, and written to its file behind the
+            // ladder's back; see eeprom.c.
+            case INT_EEPROM_BUSY_CHECK:
+                Bits[p->name1] = __atomic_load_n(&EepromBusy,
+                    __ATOMIC_RELAXED);
+                break;
+
+            case INT_EEPROM_READ:
+                Integers[p->name1] = __atomic_load_n(
+                    &EepromData[p->literal/2], __ATOMIC_RELAXED);
+                break;
+
+            case INT_EEPROM_WRITE:
+                EepromWrite(p->literal, Integers[p->name1]);
+                break;
+
             case INT_IF_BIT_SET:
                 if(!Bits[p->name1]) pc = p->name3;
                 break;
@@ -378,81 +724,625 @@ void InterpretOneCycle(void)
                 break;
 
             case INT_END_OF_PROGRAM:
+                if(profile) prof->ticks[rung] += ProfileTicks() - last;
                 return;
         }
     }
 }
 
-void initPins()
+void InterpretOneCycle(Task *t)
 {
-	//if conflicted, defaults to INPUT
-	if (GPI0 > 0) pinMode (0, INPUT); else if (GPO0 > 0) pinMode(0, OUTPUT);
-	if (GPI1 > 0) pinMode (1, INPUT); else if (GPO1 > 0) pinMode(1, OUTPUT);
-	if (GPI2 > 0) pinMode (2, INPUT); else if (GPO2 > 0) pinMode(2, OUTPUT);
-	if (GPI3 > 0) pinMode (3, INPUT); else if (GPO3 > 0) pinMode(3, OUTPUT);
-	if (GPI4 > 0) pinMode (4, INPUT); else if (GPO4 > 0) pinMode(4, OUTPUT);
-	if (GPI5 > 0) pinMode (5, INPUT); else if (GPO5 > 0) pinMode(5, OUTPUT);
-	if (GPI6 > 0) pinMode (6, INPUT); else if (GPO6 > 0) pinMode(6, OUTPUT);
-	if (GPI7 > 0) pinMode (7, INPUT); else if (GPO7 > 0) pinMode(7, OUTPUT);
+    Interpret(t, 0);
+}
 
+void InterpretProfiled(Task *t)
+{
+    Interpret(t, 1);
 }
 
+//-----------------------------------------------------------------------------
+// The physical I/O, which only the fastest task does, through the I/O
+// backend (or, with --pipeline, through the I/O thread).
+//-----------------------------------------------------------------------------
 void getInputs()
 {
-	if (GPI0 > 0) Bits[GPI0] = digitalRead(0);
-	if (GPI1 > 0) Bits[GPI1] = digitalRead(1);
-	if (GPI2 > 0) Bits[GPI2] = digitalRead(2);
-	if (GPI3 > 0) Bits[GPI3] = digitalRead(3);
-	if (GPI4 > 0) Bits[GPI4] = digitalRead(4);
-	if (GPI5 > 0) Bits[GPI5] = digitalRead(5);
-	if (GPI6 > 0) Bits[GPI6] = digitalRead(6);
-	if (GPI7 > 0) Bits[GPI7] = digitalRead(7);
+	IoWord in[IO_WORDS];
 
+	if (Pipeline) PipelineGetInputs(in); else IoReadInputs(in);
+
+	pthread_mutex_lock(&ImageLock);
+	memcpy(InputImage, in, sizeof(in));
+	CommandForceInputs(InputImage);
+	pthread_mutex_unlock(&ImageLock);
 }
 
 void setOutputs()
 {
-	if (GPO0 > 0) digitalWrite(0, Bits[GPO0]);
-	if (GPO1 > 0) digitalWrite(1, Bits[GPO1]);
-	if (GPO2 > 0) digitalWrite(2, Bits[GPO2]);
-	if (GPO3 > 0) digitalWrite(3, Bits[GPO3]);
-	if (GPO4 > 0) digitalWrite(4, Bits[GPO4]);
-	if (GPO5 > 0) digitalWrite(5, Bits[GPO5]);
-	if (GPO6 > 0) digitalWrite(6, Bits[GPO6]);
-	if (GPO7 > 0) digitalWrite(7, Bits[GPO7]);
+	IoWord out[IO_WORDS];
+	SWORD pwm[MAX_PWM];
+
+	pthread_mutex_lock(&ImageLock);
+	memcpy(out, OutputImage, sizeof(out));
+	CommandForceOutputs(out);
+	memcpy(pwm, PwmImage, sizeof(pwm));
+	pthread_mutex_unlock(&ImageLock);
+
+	if (Pipeline) PipelinePutOutputs(out); else IoWriteOutputs(out);
+	if (PwmUsed) PwmWriteOutputs(pwm);
 }
 
+//-----------------------------------------------------------------------------
+// Move a task's view of the process image in and out. The inputs and the
+// shared variables are copied in at the start of a scan, so nothing changes
+// under the ladder while it runs; what the task wrote is copied out when it
+// finishes, so the other tasks only ever see the values from a complete
+// scan.
+//-----------------------------------------------------------------------------
+void TaskCopyIn(Task *t)
+{
+    int i;
 
-int main(int argc, char **argv)
+    pthread_mutex_lock(&ImageLock);
+    for(i = 0; i < t->inputCount; i++) {
+        t->bits[t->inputs[i].addr] = IO_GET(InputImage, t->inputs[i].pin);
+    }
+    for(i = 0; i < t->sharedCount; i++) {
+        SharedRef *r = &t->shared[i];
+        if(r->writer) continue;
+        if(r->isInt) {
+            t->integers[r->addr] = SharedValues[r->slot];
+        } else {
+            t->bits[r->addr] = (BYTE)SharedValues[r->slot];
+        }
+    }
+    pthread_mutex_unlock(&ImageLock);
+}
+
+void TaskCopyOut(Task *t)
+{
+    int i;
+
+    pthread_mutex_lock(&ImageLock);
+    for(i = 0; i < t->outputCount; i++) {
+        IO_SET(OutputImage, t->outputs[i].pin, t->bits[t->outputs[i].addr]);
+    }
+    for(i = 0; i < MAX_PWM; i++) {
+        if(t->pwmUsed & (1 << i)) PwmImage[i] = t->pwm[i];
+    }
+    for(i = 0; i < t->sharedCount; i++) {
+        SharedRef *r = &t->shared[i];
+        if(!r->writer) continue;
+        SharedValues[r->slot] = r->isInt ? t->integers[r->addr] :
+            t->bits[r->addr];
+    }
+    CommandShowForces(t);
+    pthread_mutex_unlock(&ImageLock);
+}
+
+//-----------------------------------------------------------------------------
+// The scan scheduler. Each scan is released at an absolute deadline on
+// CLOCK_MONOTONIC, and the next deadline is always the previous one plus
+// exactly one period, so the error in the wake-up time never accumulates
+// into the ladder's timers. If a scan runs past the following deadline then
+// those periods are dropped (and counted) rather than run back to back, so
+// that the scan stays in phase with the original schedule.
+//
+// With --busy-poll the fastest task spins on the clock instead of sleeping,
+// which gets rid of the wake-up latency of the timer interrupt and the
+// scheduler, and so allows much shorter cycles; but it burns the whole CPU,
+// so it should get a CPU (--cpu) to itself.
+//-----------------------------------------------------------------------------
+void TimespecAddNs(struct timespec *ts, long long ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+long long TimespecDiffNs(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec)*1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+void SleepUntil(const struct timespec *deadline)
+{
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL)
+        == EINTR)
+        ;
+}
+
+void *ScanThread(void *arg)
+{
+    Task *t = arg;
+    struct timespec next, release, t0, t1, t2, t3;
+    long long period = t->cycleTime*1000LL;
+    int spin = BusyPoll && t->io;
+    int react = React && t->io;
+
+    if(Realtime) RtPrefaultStack();
+
+    // With --pipeline the I/O thread runs at the start of each period, and
+    // we run half a period later, on the inputs that it just read.
+    next = StartTime;
+    if(Pipeline && t->io) TimespecAddNs(&next, period/2);
+    SleepUntil(&next);
+    release = next;
+    while(Running) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(t->io) getInputs();
+        TaskCopyIn(t);
+        CommandApply(t);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if(Profiling) InterpretProfiled(t); else InterpretOneCycle(t);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        CommandHold(t);
+        TaskCopyOut(t);
+        if(t->io) setOutputs();
+        clock_gettime(CLOCK_MONOTONIC, &t3);
+        if(Image) ImagePublish(t, &t0, &t3);
+        if(RetainFile) RetainScan(t);
+
+        HistRecord(&t->stats.wake, TimespecDiffNs(&t0, &release));
+        HistRecord(&t->stats.in, TimespecDiffNs(&t1, &t0));
+        HistRecord(&t->stats.logic, TimespecDiffNs(&t2, &t1));
+        HistRecord(&t->stats.out, TimespecDiffNs(&t3, &t2));
+        HistRecord(&t->stats.scan, TimespecDiffNs(&t3, &t0));
+        HistRecord(&t->stats.span, TimespecDiffNs(&t3, &release));
+        t->stats.scans++;
+
+        TimespecAddNs(&next, period);
+        if(TimespecDiffNs(&t3, &next) >= 0) {
+            long long missed = TimespecDiffNs(&t3, &next)/period + 1;
+            t->stats.overruns++;
+            t->missed += missed;
+            TimespecAddNs(&next, missed*period);
+            LogPrintf("%s: scan overrun, %lld period(s) dropped (%lu total)\n",
+                t->fileName, missed, t->missed);
+        }
+        if(react) {
+            ReactWait(&next, &t0, period, &release);
+        } else if(spin) {
+            SpinUntil(&next);
+            release = next;
+        } else {
+            SleepUntil(&next);
+            release = next;
+        }
+    }
+    return NULL;
+}
+
+// Print the statistics for every task (and the I/O thread), in full or as
+// one line each.
+void PrintStats(int full)
 {
     int i;
 
-    if(argc != 2) {
-        fprintf(stderr, "usage: %s xxx.int\n", argv[0]);
+    for(i = 0; i < NumTasks; i++) {
+        Task *t = &Tasks[i];
+        if(full) {
+            StatsPrint(stdout, t->fileName, &t->stats);
+            printf("%s: %lu scan period(s) missed.\n", t->fileName,
+                t->missed);
+        } else {
+            StatsLine(stdout, t->fileName, &t->stats, t->missed);
+        }
+    }
+    if(Pipeline) {
+        if(full) {
+            StatsPrint(stdout, "I/O thread", &PipelineStats);
+        } else {
+            StatsLine(stdout, "I/O thread", &PipelineStats, PipelineMissed);
+        }
+    }
+    if(IoEdges) {
+        if(full) {
+            StatsHist(stdout, "input edge to output", &IoLatency);
+        } else {
+            printf("input edge to output: us p50 %.1f p99 %.1f max %.1f\n",
+                HistPercentile(&IoLatency, 0.5)/1e3,
+                HistPercentile(&IoLatency, 0.99)/1e3, IoLatency.max/1e3);
+        }
+    }
+    if(UdpSent) {
+        if(full) {
+            StatsHist(stdout, "remote I/O round trip", &UdpRoundTrip);
+        } else {
+            printf("remote I/O round trip: us p50 %.1f p99 %.1f max %.1f\n",
+                HistPercentile(&UdpRoundTrip, 0.5)/1e3,
+                HistPercentile(&UdpRoundTrip, 0.99)/1e3,
+                UdpRoundTrip.max/1e3);
+        }
+        printf("remote I/O: %llu frames sent, %llu answered, %llu lost, %llu "
+            "late; %lu timeouts\n", UdpSent, UdpReceived, UdpLost, UdpLate,
+            UdpTimeouts);
+    }
+    if(React) printf("%lu scans started early by an input edge\n", ReactScans);
+    if(Modbus) {
+        printf("modbus: %lu clients (%lu turned away), %llu requests, %llu "
+            "exceptions\n", ModbusClients, ModbusRejected, ModbusRequests,
+            ModbusExceptions);
+    }
+    if(Modbus || CommandSocket) {
+        printf("commands: %llu carried out, %llu turned away\n",
+            CommandsApplied, CommandsRejected);
+    }
+    if(StreamSocket) {
+        printf("stream: %lu subscribers, %llu frames (%llu coalesced), %llu "
+            "subscribers dropped\n", StreamSubscribers, StreamFrames,
+            StreamCoalesced, StreamDropped);
+    }
+    if(Adc) {
+        printf("adc: %llu samples, %llu failed readings\n", AdcSamples,
+            AdcErrors);
+    }
+    if(Pwm && PwmUsed) {
+        printf("pwm: %llu writes, %llu unchanged writes suppressed\n",
+            PwmWrites, PwmSuppressed);
+    }
+    if(UartUsed && UartDevice) {
+        printf("uart: %llu sent, %llu received; overflows: %llu send, %llu "
+            "receive; %lu errors\n", UartSent, UartReceived, UartTxOverflows,
+            UartRxOverflows, UartErrors);
+    }
+    if(EepromUsed && EepromFile) {
+        printf("eeprom: %llu writes, %llu flushes of %llu bytes", EepromWrites,
+            EepromFlushes, EepromBytesFlushed);
+        if(EepromFlushes) {
+            printf("; flush ms p50 %.1f p99 %.1f max %.1f",
+                HistPercentile(&EepromFlushTime, 0.5)/1e6,
+                HistPercentile(&EepromFlushTime, 0.99)/1e6,
+                EepromFlushTime.max/1e6);
+        }
+        printf("\n");
+    }
+    if(RetainFile) {
+        printf("retain: %llu snapshots, %llu unchanged, %llu written, %lu "
+            "failed", RetainSnapshots, RetainUnchanged, RetainWrites,
+            RetainErrors);
+        if(RetainWrites) {
+            printf("; write ms p50 %.1f p99 %.1f max %.1f",
+                HistPercentile(&RetainWriteTime, 0.5)/1e6,
+                HistPercentile(&RetainWriteTime, 0.99)/1e6,
+                RetainWriteTime.max/1e6);
+        }
+        printf("\n");
+    }
+    for(i = 0; full && Profiling && i < NumTasks; i++) {
+        ProfileReport(&Tasks[i]);
+    }
+    if(Io) {
+        printf("outputs: %llu writes, %llu pin writes, %llu unchanged pin "
+            "writes suppressed\n", IoWrites, IoPinWrites, IoPinsSuppressed);
+    }
+}
+
+void StopRunning(int sig)
+{
+    Running = 0;
+}
+
+void RequestStats(int sig)
+{
+    StatsRequested = 1;
+}
+
+void Usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [options] xxx.int [yyy.int ...]\n"
+        "  -r, --realtime        lock memory and run the scans under "
+            "SCHED_FIFO\n"
+        "  -p, --priority=N      SCHED_FIFO priority of the fastest task for "
+            "--realtime\n"
+        "                        (default %d; slower tasks get lower ones)\n"
+        "  -c, --cpu=N           pin the scan threads to CPU N\n"
+        "  -b, --busy-poll[=HOW] spin instead of sleeping between scans of "
+            "the fastest\n"
+        "                        task, with HOW = pause (default), yield or "
+            "none\n"
+        "  -I, --io=NAME[:ARGS]  read and write the pins with I/O backend "
+            "NAME:\n"
+#ifndef NO_WIRINGPI
+        "                        wiringpi (the default), "
+            "gpiomem[:path][,bcm],\n"
+        "                        gpiochip[:path][,bcm][,debounce=us] or\n"
+        "                        sim[:shm-name][,delay=us] or\n"
+        "                        udp:host[:port][,timeout=ms][,hold]\n"
+#else
+        "                        sim[:shm-name][,delay=us] (the default),\n"
+        "                        gpiomem[:path][,bcm] or\n"
+        "                        gpiochip[:path][,bcm][,debounce=us] or\n"
+        "                        udp:host[:port][,timeout=ms][,hold]\n"
+#endif
+        "  -m, --map=FILE        name the pins, and make them active-low or "
+            "put them\n"
+        "                        on other backends, as FILE says\n"
+        "  -d, --debounce=N      accept an input change only once it has "
+            "lasted N\n"
+        "                        scans in a row (up to %d)\n"
+        "  -R, --refresh=N       write every output, changed or not, on "
+            "every Nth scan\n"
+        "                        (default %d; 1 writes them all every "
+            "scan)\n"
+        "  -e, --react[=US]      also scan as soon as an input changes, but "
+            "no sooner\n"
+        "                        than US (default %lld) after the last "
+            "scan\n"
+        "  -L, --latency         time each input edge to the writing of "
+            "the outputs\n"
+        "  -S, --image[=NAME]    publish the ladders' variables in shared "
+            "memory NAME\n"
+        "                        (/ldpi-image) for other programs to read\n"
+        "  -C, --control[=PATH]  write and force variables through UNIX "
+            "socket PATH\n"
+        "                        (/tmp/ldpi.sock)\n"
+        "  -T, --stream[=PATH]   send subscribers the changes to the "
+            "variables through\n"
+        "                        UNIX socket PATH (/tmp/ldpi-stream.sock)\n"
+        "  -M, --modbus[=[ADDR:]PORT]\n"
+        "                        serve the ladder's variables over Modbus "
+            "TCP (port 502)\n"
+        "  -a, --adc=NAME[:ARGS] sample the ladder's READ ADC channels with "
+            "converter\n"
+        "                        NAME: mcp3008[:dev][,speed=HZ] or "
+            "file:path, with\n"
+        "                        ,rate=HZ (1000 times a second)\n"
+        "  -w, --pwm=NAME[:ARGS] drive the ladder's SET PWM channels with "
+            "NAME: sysfs[:chip]\n"
+        "                        or file:path, with ,freq=HZ if the "
+            "program has none\n"
+        "                        (1000 Hz)\n"
+        "  -u, --uart=DEV[,baud=N]\n"
+        "                        use serial port DEV (or a new pty, with "
+            "pty) for the\n"
+        "                        ladder's UART SEND and RECV (9600 baud)\n"
+        "  -E, --eeprom=FILE[,flush=MS]\n"
+        "                        keep the ladder's EEPROM in FILE, writing "
+            "the changes\n"
+        "                        to it every MS (1000) ms\n"
+        "  -K, --retain=FILE[,every=N][,only=NAME:NAME...]\n"
+        "                        keep the ladders' variables (or just "
+            "those named) in\n"
+        "                        FILE, snapshotted every N (100) scans, "
+            "and restore them\n"
+        "                        at startup\n"
+        "  -F, --profile         count each instruction and time each rung, "
+            "and print\n"
+        "                        them, hottest first, with the full "
+            "statistics\n"
+        "  -P, --pipeline[=CPU]  read and write the pins on a separate I/O "
+            "thread\n"
+        "                        (on CPU, if given); adds a cycle of "
+            "latency\n"
+        "  -s, --stats=SEC       print a line of scan statistics every SEC "
+            "seconds\n"
+        "                        (a full report is printed on SIGUSR1)\n"
+        "  -V, --virtual=SEC     run SEC seconds of simulated time as fast "
+            "as possible,\n"
+        "                        without touching the pins\n"
+        "  -i, --stimulus=FILE   with --virtual, take the inputs from FILE\n"
+        "  -o, --record=FILE     with --virtual, record the outputs to FILE\n",
+        prog, RtPriority, DEBOUNCE_MAX, IoRefresh, ReactGap/1000);
+    exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        { "realtime",   no_argument,        NULL, 'r' },
+        { "priority",   required_argument,  NULL, 'p' },
+        { "cpu",        required_argument,  NULL, 'c' },
+        { "busy-poll",  optional_argument,  NULL, 'b' },
+        { "pipeline",   optional_argument,  NULL, 'P' },
+        { "io",         required_argument,  NULL, 'I' },
+        { "map",        required_argument,  NULL, 'm' },
+        { "debounce",   required_argument,  NULL, 'd' },
+        { "refresh",    required_argument,  NULL, 'R' },
+        { "react",      optional_argument,  NULL, 'e' },
+        { "latency",    no_argument,        NULL, 'L' },
+        { "control",    optional_argument,  NULL, 'C' },
+        { "stream",     optional_argument,  NULL, 'T' },
+        { "modbus",     optional_argument,  NULL, 'M' },
+        { "image",      optional_argument,  NULL, 'S' },
+        { "adc",        required_argument,  NULL, 'a' },
+        { "pwm",        required_argument,  NULL, 'w' },
+        { "uart",       required_argument,  NULL, 'u' },
+        { "eeprom",     required_argument,  NULL, 'E' },
+        { "retain",     required_argument,  NULL, 'K' },
+        { "profile",    no_argument,        NULL, 'F' },
+        { "stats",      required_argument,  NULL, 's' },
+        { "virtual",    required_argument,  NULL, 'V' },
+        { "stimulus",   required_argument,  NULL, 'i' },
+        { "record",     required_argument,  NULL, 'o' },
+        { NULL, 0, NULL, 0 }
+    };
+    pthread_mutexattr_t mattr;
+    pthread_attr_t attr;
+    sigset_t block, old;
+    time_t lastStats;
+    double virtualTime = 0;
+    int c, i, pin;
+
+    while((c = getopt_long(argc, argv, "rp:c:b::P::I:m:d:R:e::LC::T::M::S::a:w:u:E:K:Fs:V:i:o:", opts, NULL)) != -1) {
+        switch(c) {
+            case 'r': Realtime = 1; break;
+            case 'p': RtPriority = atoi(optarg); break;
+            case 'c': RtCpu = atoi(optarg); break;
+            case 'b':
+                if(!optarg || strcmp(optarg, "pause") == 0) {
+                    BusyPoll = BUSY_POLL_PAUSE;
+                } else if(strcmp(optarg, "yield") == 0) {
+                    BusyPoll = BUSY_POLL_YIELD;
+                } else if(strcmp(optarg, "none") == 0) {
+                    BusyPoll = BUSY_POLL_NONE;
+                } else {
+                    Usage(argv[0]);
+                }
+                break;
+            case 'P':
+                Pipeline = 1;
+                if(optarg) PipelineCpu = atoi(optarg);
+                break;
+            case 'I': IoSelect(optarg); break;
+            case 'm': IoLoadMap(optarg); break;
+            case 'd':
+                IoDebounce = atoi(optarg);
+                if(IoDebounce < 0 || IoDebounce > DEBOUNCE_MAX) Usage(argv[0]);
+                break;
+            case 'R':
+                IoRefresh = atoi(optarg);
+                if(IoRefresh < 1) Usage(argv[0]);
+                break;
+            case 'e':
+                React = IoEdges = 1;
+                if(optarg) ReactGap = atoll(optarg)*1000;
+                break;
+            case 'L': IoEdges = 1; break;
+            case 'C': CommandConfigure(optarg); break;
+            case 'T': StreamConfigure(optarg); break;
+            case 'M': ModbusConfigure(optarg); break;
+            case 'S': ImageConfigure(optarg); break;
+            case 'a': AdcConfigure(optarg); break;
+            case 'w': PwmConfigure(optarg); break;
+            case 'u': UartConfigure(optarg); break;
+            case 'E': EepromConfigure(optarg); break;
+            case 'K': RetainConfigure(optarg); break;
+            case 'F': Profiling = 1; break;
+            case 's': StatsInterval = atoi(optarg); break;
+            case 'V': virtualTime = atof(optarg); break;
+            case 'i': StimulusFile = optarg; break;
+            case 'o': RecordFile = optarg; break;
+            default: Usage(argv[0]); break;
+        }
+    }
+    if(optind >= argc) Usage(argv[0]);
+    if(React && (Pipeline || BusyPoll)) {
+        fprintf(stderr, "--react can't be used with --pipeline or "
+            "--busy-poll\n");
+        return -1;
+    }
+    if(argc - optind > MAX_TASKS) {
+        fprintf(stderr, "at most %d programs\n", MAX_TASKS);
         return -1;
     }
 
     printf("Loading program...\n");
-    LoadProgram(argv[1]);
-    memset(Integers, 0, sizeof(Integers));
-    memset(Bits, 0, sizeof(Bits));
-    printf("Setting up WiringPi...\n");
-    wiringPiSetup();
-    printf("Initializing pins...\n");
-    initPins();
-    
-    printf("inputs : %d %d %d %d %d %d %d %d\n",GPI0, GPI1, GPI2, GPI3, GPI4, GPI5, GPI6, GPI7);
-    printf("outputs: %d %d %d %d %d %d %d %d\n",GPO0, GPO1, GPO2, GPO3, GPO4, GPO5, GPO6, GPO7);
-
-    Disassemble();
+    for(NumTasks = 0; optind < argc; optind++, NumTasks++) {
+        LoadProgram(&Tasks[NumTasks], argv[optind]);
+    }
+    LinkTasks();
+    for(i = 0; Profiling && i < NumTasks; i++) ProfileInit(&Tasks[i]);
+    if(virtualTime <= 0) IoInit();
+
+    for(i = 0; i < NumTasks; i++) {
+        Task *t = &Tasks[i];
+        printf("%s: every %ld us%s\n", t->fileName, t->cycleTime,
+            t->io ? ", does the I/O" : "");
+        printf("inputs :");
+        for(pin = 0; pin < t->inputCount; pin++) {
+            printf(" GPI%d=bits[%d]%s", t->inputs[pin].pin,
+                t->inputs[pin].addr,
+                IO_GET(IoInvert, t->inputs[pin].pin) ? "(low)" : "");
+        }
+        printf("\noutputs:");
+        for(pin = 0; pin < t->outputCount; pin++) {
+            printf(" GPO%d=bits[%d]%s", t->outputs[pin].pin,
+                t->outputs[pin].addr,
+                IO_GET(IoInvert, t->outputs[pin].pin) ? "(low)" : "");
+        }
+        printf("\n");
+        Disassemble(t);
+    }
+    printf("Scan statistics cost %.0f ns per timestamp\n", StatsOverhead());
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&ImageLock, &mattr);
+
+    signal(SIGINT, StopRunning);
+    signal(SIGTERM, StopRunning);
+    signal(SIGUSR1, RequestStats);
+
+    if(virtualTime > 0) {
+        printf("Running ladder in virtual time...\n");
+        RunVirtual(virtualTime);
+        return 0;
+    }
+
+    CommandInit();
+    if(ImageShm || Modbus || CommandSocket || StreamSocket) ImageCreate();
+    AdcStart();
+    PwmInit();
+    UartStart();
+    EepromStart();
+    if(RetainFile) RetainRestore();
+
+    if(Realtime) {
+        printf("Locking memory; scans at SCHED_FIFO priority %d", RtPriority);
+        if(NumTasks > 1) printf(" down to %d", Tasks[NumTasks-1].priority);
+        if(RtCpu >= 0) printf(" on CPU %d", RtCpu);
+        printf("\n");
+        RtLockMemory();
+    }
+
+    // The scan threads take no signals, so that they are all handled here.
+    sigfillset(&block);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
     printf("Running ladder...\n");
-    while (1) {
-	getInputs();
-        InterpretOneCycle();
-	setOutputs();
-        sleep(1);
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &StartTime);
+    TimespecAddNs(&StartTime, 1000*1000);
+    if(React) ReactInit(Realtime ? Tasks[0].priority : 0);
+    if(Modbus) ModbusStart();
+    if(CommandSocket) CommandStart();
+    if(StreamSocket) StreamStart();
+    RetainStart();
+    if(Pipeline) {
+        PipelineStart(Tasks[0].cycleTime*1000LL,
+            Realtime ? Tasks[0].priority : 0);
+    }
+    for(i = 0; i < NumTasks; i++) {
+        // A spinning task would starve anything else on its CPU, so it has
+        // the CPU to itself and the others go wherever the kernel likes.
+        RtThreadAttr(&attr, Realtime ? Tasks[i].priority : 0,
+            (BusyPoll && i > 0) ? -1 : RtCpu);
+        if((c = pthread_create(&Tasks[i].thread, &attr, ScanThread,
+            &Tasks[i])) != 0)
+        {
+            fprintf(stderr, "couldn't start scan thread: %s\n", strerror(c));
+            exit(-1);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    // This thread owns stdout from here on.
+    lastStats = time(NULL);
+    while(Running) {
+        usleep(100*1000);
+        LogDrain();
+        if(StatsRequested) {
+            StatsRequested = 0;
+            PrintStats(1);
+        }
+        if(StatsInterval > 0 && time(NULL) - lastStats >= StatsInterval) {
+            lastStats = time(NULL);
+            PrintStats(0);
+        }
+        fflush(stdout);
     }
+    for(i = 0; i < NumTasks; i++) pthread_join(Tasks[i].thread, NULL);
+    if(Pipeline) PipelineStop();
+    CommandStop();
+    StreamStop();
+    AdcStop();
+    PwmStop();
+    UartStop();
+    EepromStop();
+    RetainStop();
+    ImageDestroy();
+    LogDrain();
+    PrintStats(1);
 
     return 0;
 }
-
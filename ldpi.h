@@ -0,0 +1,178 @@
+//-----------------------------------------------------------------------------
+// Definitions shared between the parts of ldpi.
+//
+// ldpi can run several ladder programs at once, each as its own 'task' with
+// its own program, variables and scan period. The tasks share one process
+// image: the GPIO pins, and any variable whose name appears in more than one
+// of the programs.
+//-----------------------------------------------------------------------------
+#ifndef __LDPI_H
+#define __LDPI_H
+
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+typedef unsigned char BYTE;     // 8-bit unsigned
+typedef unsigned short WORD;    // 16-bit unsigned
+typedef signed short SWORD;     // 16-bit signed
+
+// Some arbitrary limits on the program and data size
+#define MAX_OPS                 1024
+#define MAX_VARIABLES           128
+#define MAX_INTERNAL_RELAYS     128
+#define MAX_SYMBOLS             256
+#define MAX_SYMBOL_LEN          64
+#define MAX_TASKS               8
+#define MAX_SHARED              128
+
+// The I/O pins we know about: GPI0..GPI63 and GPO0..GPO63, enough for
+// every GPIO on the Pi's header under either numbering. What pin n actually
+// is depends on the I/O backend; for wiringPi it is wiringPi pin n.
+#define MAX_PINS                64
+
+// PWM0..PWM3, the hardware PWM channels; see pwm.c.
+#define MAX_PWM                 4
+
+// Images of the pins are packed one bit per pin, so that whole sets of pins
+// can be handled a word at a time.
+typedef unsigned int IoWord;
+#define IO_WORD_BITS            32
+#define IO_WORDS                ((MAX_PINS + IO_WORD_BITS - 1) / IO_WORD_BITS)
+#define IO_GET(img, n)          (((img)[(n) / IO_WORD_BITS] >> \
+                                    ((n) % IO_WORD_BITS)) & 1)
+#define IO_SET(img, n, v)       do { \
+                                    IoWord _m = 1u << ((n) % IO_WORD_BITS); \
+                                    if(v) (img)[(n) / IO_WORD_BITS] |= _m; \
+                                    else (img)[(n) / IO_WORD_BITS] &= ~_m; \
+                                } while(0)
+
+// This data structure represents a single instruction for the 'virtual
+// machine.' The .op field gives the opcode, and the other fields give
+// arguments. I have defined all of these as 16-bit fields for generality,
+// but if you want then you can crunch them down to 8-bit fields (and
+// limit yourself to 256 of each type of variable, of course). If you
+// crunch down .op then nothing bad happens at all. If you crunch down
+// .literal then you only have 8-bit literals now (so you can't move
+// 300 into 'var'). If you crunch down .name3 then that limits your code size,
+// because that is the field used to encode the jump addresses.
+// 
+// A more compact encoding is very possible if space is a problem for
+// you. You will probably need some kind of translator regardless, though,
+// to put it in whatever format you're going to pack in flash or whatever,
+// and also to pick out the name <-> address mappings for those variables
+// that you're going to use for your interface out. I will therefore leave
+// that up to you.
+typedef struct {
+    WORD    op;
+    WORD    name1;
+    WORD    name2;
+    WORD    name3;
+    SWORD   literal;
+} BinOp;
+
+// An entry from the symbol table at the end of the .int file.
+typedef struct {
+    char    name[MAX_SYMBOL_LEN];
+    WORD    addr;
+    BYTE    isInt;      // in Integers[] rather than Bits[]
+} Symbol;
+
+// A pin that a task reads or writes, and the relay in its Bits[] that
+// stands for it.
+typedef struct {
+    WORD    pin;
+    WORD    addr;
+} PinRef;
+
+// A task's reference to a variable that it shares with other tasks.
+typedef struct {
+    WORD    addr;       // in this task's Bits[] or Integers[]
+    WORD    slot;       // in SharedValues[]
+    BYTE    isInt;
+    BYTE    writer;     // this task is the one that writes it
+} SharedRef;
+
+typedef struct {
+    const char *fileName;
+
+    BinOp       program[MAX_OPS];
+    SWORD       integers[MAX_VARIABLES];
+    BYTE        bits[MAX_INTERNAL_RELAYS];
+
+    Symbol      symbols[MAX_SYMBOLS];
+    int         symbolCount;
+
+    // The scan period in microseconds, from the $$cycle line of the .int
+    // file.
+    long        cycleTime;
+
+    // The pins that the program uses, so that copying them in and out
+    // costs only as much as the pins that are actually there.
+    PinRef      inputs[MAX_PINS];
+    int         inputCount;
+    PinRef      outputs[MAX_PINS];
+    int         outputCount;
+
+    SharedRef   shared[MAX_SHARED];
+    int         sharedCount;
+
+    // The duty cycles (in percent) that the program's SET PWMs have set,
+    // copied out at the end of the scan like the outputs; bit n of pwmUsed
+    // is set if it sets PWMn.
+    SWORD       pwm[MAX_PWM];
+    int         pwmUsed;
+
+    // The task that does the physical I/O for everyone (the fastest one).
+    int         io;
+    int         priority;
+
+    pthread_t   thread;
+    ScanStats   stats;
+    // The number of scan periods that we have had to drop because a scan
+    // ran past its deadline.
+    unsigned long missed;
+
+    // With --profile, the counts and times for this task; see profile.c.
+    struct Profile *profile;
+} Task;
+
+typedef struct Profile Profile;
+
+extern Task Tasks[MAX_TASKS];
+extern int NumTasks;
+
+// The shared process image; see ldpi.c.
+extern IoWord InputImage[IO_WORDS];
+extern IoWord OutputImage[IO_WORDS];
+extern pthread_mutex_t ImageLock;
+
+// Which pins are used as inputs and which as outputs, worked out from all
+// of the tasks.
+extern IoWord InputPins[IO_WORDS];
+extern IoWord OutputPins[IO_WORDS];
+
+extern volatile int Running;
+
+extern struct timespec StartTime;
+
+
+void InterpretOneCycle(Task *t);
+// The same, but keeping t->profile; see profile.c.
+void InterpretProfiled(Task *t);
+void DisassembleOp(const BinOp *p);
+void TaskCopyIn(Task *t);
+void TaskCopyOut(Task *t);
+
+void TimespecAddNs(struct timespec *ts, long long ns);
+long long TimespecDiffNs(const struct timespec *a, const struct timespec *b);
+
+// Virtual-time execution (vtime.c): run the tasks back to back for the
+// given number of simulated seconds, taking the inputs from a stimulus file
+// and recording the outputs, instead of using the real pins and clock.
+extern const char *StimulusFile;
+extern const char *RecordFile;
+void RunVirtual(double seconds);
+
+#endif
@@ -0,0 +1,92 @@
+//-----------------------------------------------------------------------------
+// The reader side of ldpi's shared-memory process image; see ldpiimage.h.
+// This is built into libldpiimage.a, for other programs to link with, and
+// into ldpi itself, whose Modbus server reads the image the same way.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "ldpiimage.h"
+
+// How many times to find the writer part way through before giving up.
+#define READ_TRIES              1000
+
+LdpiImage *LdpiImageOpen(const char *name)
+{
+    LdpiImage *img;
+    int fd;
+
+    fd = shm_open(name ? name : LDPI_IMAGE_DEFAULT, O_RDONLY, 0);
+    if(fd < 0) return NULL;
+    img = mmap(NULL, sizeof(LdpiImage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(img == MAP_FAILED) return NULL;
+
+    if(__atomic_load_n(&img->magic, __ATOMIC_ACQUIRE) != LDPI_IMAGE_MAGIC ||
+        img->version != LDPI_IMAGE_VERSION)
+    {
+        munmap(img, sizeof(LdpiImage));
+        errno = EAGAIN;
+        return NULL;
+    }
+    return img;
+}
+
+void LdpiImageClose(LdpiImage *img)
+{
+    if(img) munmap(img, sizeof(LdpiImage));
+}
+
+int LdpiImageFind(const LdpiImage *img, const char *name)
+{
+    const char *colon = strchr(name, ':');
+    unsigned i;
+
+    for(i = 0; i < img->symbolCount; i++) {
+        const LdpiImageSymbol *s = &img->symbols[i];
+        if(colon) {
+            const char *file = img->tasks[s->task].fileName;
+            if(strncmp(file, name, colon - name) != 0 ||
+                file[colon - name] != '\0' || strcmp(s->name, colon + 1) != 0)
+            {
+                continue;
+            }
+        } else if(strcmp(s->name, name) != 0) {
+            continue;
+        }
+        return i;
+    }
+    return -1;
+}
+
+int LdpiImageRead(const LdpiImage *img, int task, LdpiImageTask *out)
+{
+    const LdpiImageTask *t = &img->tasks[task];
+    unsigned seq;
+    int tries;
+
+    for(tries = 0; tries < READ_TRIES; tries++) {
+        seq = __atomic_load_n(&t->seq, __ATOMIC_ACQUIRE);
+        if(!(seq & 1)) {
+            memcpy(out, t, sizeof(*out));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if(__atomic_load_n(&t->seq, __ATOMIC_RELAXED) == seq) return 0;
+        }
+        // The writer is part way through; it will be done in well under a
+        // microsecond, unless it has been preempted.
+        if(tries > 10) sched_yield();
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+int LdpiImageValue(const LdpiImageTask *snap, const LdpiImageSymbol *sym)
+{
+    return sym->isInt ? snap->integers[sym->addr] : snap->bits[sym->addr];
+}
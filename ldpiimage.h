@@ -0,0 +1,84 @@
+//-----------------------------------------------------------------------------
+// The process image that ldpi publishes in POSIX shared memory (with
+// --image), and a small library for reading it. An HMI, a logger or a test
+// script on the same machine can then watch every ladder's variables
+// without going through ldpi at all:
+//
+//      LdpiImage *img = LdpiImageOpen(NULL);
+//      int sym = LdpiImageFind(img, "Tcnt");
+//      LdpiImageTask snap;
+//      if(LdpiImageRead(img, img->symbols[sym].task, &snap) == 0)
+//          printf("%d\n", LdpiImageValue(&snap, &img->symbols[sym]));
+//
+// Each task's variables are copied in at the end of every one of its scans
+// under a sequence lock: the count in seq is odd while ldpi is writing, and
+// a reader copies the variables out and then checks that seq hasn't
+// changed, trying again if it has. The reader maps the segment read-only
+// and takes no locks, so however it behaves, it can never hold up a scan.
+//-----------------------------------------------------------------------------
+#ifndef __LDPIIMAGE_H
+#define __LDPIIMAGE_H
+
+#define LDPI_IMAGE_MAGIC        0x6c647069      // 'ldpi'
+#define LDPI_IMAGE_VERSION      1
+#define LDPI_IMAGE_DEFAULT      "/ldpi-image"
+
+// These match the limits in ldpi.h.
+#define LDPI_IMAGE_TASKS        8
+#define LDPI_IMAGE_BITS         128
+#define LDPI_IMAGE_INTS         128
+#define LDPI_IMAGE_SYMBOLS      (LDPI_IMAGE_TASKS*256)
+#define LDPI_IMAGE_NAME_LEN     64
+
+typedef struct {
+    char                name[LDPI_IMAGE_NAME_LEN];
+    unsigned short      addr;       // in bits[] or integers[]
+    unsigned char       isInt;
+    unsigned char       task;
+} LdpiImageSymbol;
+
+typedef struct {
+    // Set up before the image is published, and not changed after.
+    char                fileName[128];
+    long                cycleTime;  // us
+
+    // Written at the end of each scan, under seq.
+    unsigned            seq;
+    unsigned long long  cycles;     // scans so far
+    long long           scanStart;  // CLOCK_MONOTONIC ns
+    long long           scanEnd;
+    unsigned char       bits[LDPI_IMAGE_BITS];
+    short               integers[LDPI_IMAGE_INTS];
+} __attribute__((aligned(64))) LdpiImageTask;
+
+typedef struct {
+    unsigned            magic;      // set last, once all of this is ready
+    unsigned            version;
+    int                 pid;        // of ldpi; 0 once it has stopped
+    unsigned            taskCount;
+    unsigned            symbolCount;
+    // Add to a CLOCK_MONOTONIC time to get (about) the CLOCK_REALTIME one.
+    long long           realtimeOffset;
+
+    LdpiImageTask       tasks[LDPI_IMAGE_TASKS];
+    LdpiImageSymbol     symbols[LDPI_IMAGE_SYMBOLS];
+} LdpiImage;
+
+// Map the image called name (LDPI_IMAGE_DEFAULT if NULL) read-only; NULL,
+// with errno set, if it isn't there or ldpi hasn't finished setting it up.
+LdpiImage *LdpiImageOpen(const char *name);
+void LdpiImageClose(LdpiImage *img);
+
+// The index in img->symbols[] of the variable called name, or -1. With
+// several programs, "file:name" picks the one in that program.
+int LdpiImageFind(const LdpiImage *img, const char *name);
+
+// Copy out a consistent snapshot of task's variables, as of the end of one
+// scan. Returns 0, or -1 (with errno EAGAIN) if ldpi seems to have stopped
+// in the middle of writing them.
+int LdpiImageRead(const LdpiImage *img, int task, LdpiImageTask *out);
+
+// The value of sym in a snapshot of its task.
+int LdpiImageValue(const LdpiImageTask *snap, const LdpiImageSymbol *sym);
+
+#endif
@@ -0,0 +1,185 @@
+//-----------------------------------------------------------------------------
+// A remote I/O node for ldpi's udp backend (--io=udp), to test with over
+// loopback or between two machines. It answers each of ldpi's outputs
+// frames with its inputs, as ldpiudp.h describes, and keeps its pins in a
+// shared-memory segment laid out like --io=sim's, so that ldpisim can drive
+// and watch them:
+//
+//      $ ./ldpinode &
+//      $ ./ldpi --io=udp:localhost xxx.int &
+//      $ ./ldpisim -n ldpi-node set 3 1
+//      $ ./ldpisim -n ldpi-node show
+//
+// Options: -p port (5020), -n name (of the segment, /ldpi-node), -t ms (the
+// time without a frame from ldpi after which the outputs are turned off;
+// 100), -l percent (of ldpi's frames to lose on purpose), -d us (to wait
+// before answering).
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ldpisim.h"
+#include "ldpiudp.h"
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: ldpinode [-p port] [-n name] [-t timeout_ms] "
+        "[-l loss_percent] [-d delay_us]\n");
+    exit(-1);
+}
+
+static long long Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static LdpiSim *Open(const char *name)
+{
+    LdpiSim *sim;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+    if(fd < 0 || ftruncate(fd, sizeof(LdpiSim)) != 0) {
+        perror(name);
+        exit(-1);
+    }
+    sim = mmap(NULL, sizeof(LdpiSim), PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    close(fd);
+    if(sim == MAP_FAILED) {
+        perror("mmap");
+        exit(-1);
+    }
+    memset(sim->outputs, 0, sizeof(sim->outputs));
+    sim->version = LDPI_SIM_VERSION;
+    __atomic_store_n(&sim->magic, LDPI_SIM_MAGIC, __ATOMIC_RELEASE);
+    return sim;
+}
+
+static void SetOutputs(LdpiSim *sim, const unsigned *pins)
+{
+    int i;
+
+    for(i = 0; i < LDPI_UDP_WORDS && i < LDPI_SIM_WORDS; i++) {
+        __atomic_store_n(&sim->outputs[i], pins ? pins[i] : 0,
+            __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_add(&sim->writes, 1, __ATOMIC_RELEASE);
+}
+
+int main(int argc, char **argv)
+{
+    char name[64] = "/ldpi-node";
+    int port = LDPI_UDP_PORT, loss = 0, c, fd, i, safe = 1, heard = 0;
+    long long timeout = 100, delay = 0, last = 0, wait;
+    unsigned seq, lastSeq = 0, pins[LDPI_UDP_WORDS];
+    struct sockaddr_in sa, from;
+    socklen_t fromLen;
+    LdpiUdpFrame f;
+    struct pollfd pfd;
+    LdpiSim *sim;
+
+    while((c = getopt(argc, argv, "p:n:t:l:d:")) != -1) {
+        switch(c) {
+            case 'p': port = atoi(optarg); break;
+            case 'n':
+                snprintf(name, sizeof(name), "%s%s", *optarg == '/' ? "" : "/",
+                    optarg);
+                break;
+            case 't': timeout = atol(optarg); break;
+            case 'l': loss = atoi(optarg); break;
+            case 'd': delay = atol(optarg); break;
+            default: Usage();
+        }
+    }
+    sim = Open(name);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("ldpinode");
+        return 1;
+    }
+    printf("ldpinode: port %d, pins in %s, outputs off after %lld ms\n", port,
+        name, timeout);
+    fflush(stdout);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for(;;) {
+        wait = -1;
+        if(!safe) {
+            wait = timeout - (Now() - last)/1000000;
+            if(wait < 0) wait = 0;
+        }
+        if(poll(&pfd, 1, wait) == 0) {
+            // The watchdog: ldpi (or the network) has gone quiet.
+            SetOutputs(sim, NULL);
+            safe = 1;
+            printf("ldpinode: nothing from ldpi for %lld ms; outputs off\n",
+                timeout);
+            fflush(stdout);
+            continue;
+        }
+
+        fromLen = sizeof(from);
+        if(recvfrom(fd, &f, sizeof(f), 0, (struct sockaddr *)&from, &fromLen)
+            != sizeof(f) || ntohl(f.magic) != LDPI_UDP_MAGIC ||
+            ntohs(f.type) != LDPI_UDP_OUTPUTS)
+        {
+            continue;
+        }
+        if(loss && rand() % 100 < loss) continue;
+
+        // Ignore a frame older than the last, unless ldpi has restarted.
+        seq = ntohl(f.seq);
+        if(heard && (int)(seq - lastSeq) <= 0 && lastSeq - seq < 1000) continue;
+        lastSeq = seq;
+        last = Now();
+
+        for(i = 0; i < LDPI_UDP_WORDS; i++) {
+            pins[i] = ntohl(f.pins[i]) & ntohl(f.outputPins[i]);
+            if(i < LDPI_SIM_WORDS) {
+                sim->inputPins[i] = ntohl(f.inputPins[i]);
+                sim->outputPins[i] = ntohl(f.outputPins[i]);
+            }
+        }
+        SetOutputs(sim, pins);
+
+        if(delay) usleep(delay);
+        f.type = htons(LDPI_UDP_INPUTS);
+        f.flags = htonl(safe && heard ? LDPI_UDP_SAFE : 0);
+        for(i = 0; i < LDPI_UDP_WORDS; i++) {
+            f.pins[i] = htonl(i < LDPI_SIM_WORDS ?
+                __atomic_load_n(&sim->inputs[i], __ATOMIC_ACQUIRE) &
+                sim->inputPins[i] : 0);
+        }
+        __atomic_fetch_add(&sim->reads, 1, __ATOMIC_RELEASE);
+        sendto(fd, &f, sizeof(f), 0, (struct sockaddr *)&from, fromLen);
+
+        if(safe) {
+            printf("ldpinode: %s ldpi at %s\n", heard ? "back in touch with" :
+                "hearing from", inet_ntoa(from.sin_addr));
+            fflush(stdout);
+        }
+        safe = 0;
+        heard = 1;
+    }
+    return 0;
+}
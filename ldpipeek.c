@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------
+// A small tool to look at ldpi's process image (--image) from the command
+// line or a test script, and an example of using libldpiimage:
+//
+//      $ ./ldpipeek                print every variable, once
+//      $ ./ldpipeek Tcnt YGPO1     print just these
+//      $ ./ldpipeek -w 100 Tcnt    and again every 100 ms, until Ctrl-C
+//
+// Use -n name for a shared-memory object other than /ldpi-image. With
+// -s socket, it follows ldpi's change stream (--stream) instead, printing
+// the variables each time any of them changes; that shows how to read the
+// stream, as described in ldpistream.h.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ldpiimage.h"
+#include "ldpistream.h"
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: ldpipeek [-n name] [-w ms] [variable ...]\n"
+        "       ldpipeek -s socket [variable ...]\n");
+    exit(-1);
+}
+
+// Read exactly n bytes, or give up.
+static void Read(FILE *f, void *buf, size_t n)
+{
+    if(fread(buf, 1, n, f) != n) {
+        fprintf(stderr, "ldpi has closed the stream\n");
+        exit(1);
+    }
+}
+
+static int Follow(const char *path, int argc, char **argv)
+{
+    static char names[LDPI_IMAGE_SYMBOLS][2*LDPI_IMAGE_NAME_LEN];
+    static int isInt[LDPI_IMAGE_SYMBOLS], value[LDPI_IMAGE_SYMBOLS];
+    struct sockaddr_un sa;
+    LdpiStreamHeader h;
+    char line[512], var[2*LDPI_IMAGE_NAME_LEN], kind[8];
+    unsigned short e;
+    short v;
+    int fd, i, k, count = 0;
+    FILE *f;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    f = fdopen(fd, "r+");
+    fprintf(f, "subscribe");
+    for(i = 0; i < argc; i++) fprintf(f, " %s", argv[i]);
+    fprintf(f, "%s\n", argc ? "" : " *");
+    fflush(f);
+
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "var %d %127s %7s", &k, var, kind) == 3 &&
+            k >= 0 && k < LDPI_IMAGE_SYMBOLS)
+        {
+            memcpy(names[k], var, sizeof(var));
+            isInt[k] = strcmp(kind, "int") == 0;
+            if(k >= count) count = k + 1;
+        } else if(strncmp(line, "ok", 2) == 0) {
+            break;
+        } else {
+            fprintf(stderr, "%s", line);
+            return 1;
+        }
+    }
+
+    for(;;) {
+        Read(f, &h, sizeof(h));
+        for(i = 0; i < h.count; i++) {
+            Read(f, &e, sizeof(e));
+            k = e & ~LDPI_STREAM_VALUE;
+            if(k >= count) continue;
+            if(isInt[k]) {
+                Read(f, &v, sizeof(v));
+                value[k] = v;
+            } else {
+                value[k] = !!(e & LDPI_STREAM_VALUE);
+            }
+        }
+        printf("%llu%s", h.cycle, h.flags & LDPI_STREAM_COALESCED ? "+" : "");
+        for(k = 0; k < count; k++) printf(" %s %d", names[k], value[k]);
+        printf("\n");
+        fflush(stdout);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static LdpiImageTask snap[LDPI_IMAGE_TASKS];
+    static int want[LDPI_IMAGE_SYMBOLS];
+    const char *name = NULL;
+    LdpiImage *img;
+    long ms = 0;
+    int c, i, n = 0;
+    unsigned t;
+
+    while((c = getopt(argc, argv, "n:w:s:")) != -1) {
+        if(c == 's') return Follow(optarg, argc - optind, argv + optind);
+        else if(c == 'n') name = optarg;
+        else if(c == 'w') ms = atol(optarg);
+        else Usage();
+    }
+
+    if(!(img = LdpiImageOpen(name))) {
+        perror(name ? name : LDPI_IMAGE_DEFAULT);
+        return 1;
+    }
+    for(i = optind; i < argc; i++) {
+        if((want[n++] = LdpiImageFind(img, argv[i])) < 0) {
+            fprintf(stderr, "no variable '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if(!n) {
+        for(n = 0; n < (int)img->symbolCount; n++) want[n] = n;
+    }
+
+    for(;;) {
+        for(t = 0; t < img->taskCount; t++) {
+            if(LdpiImageRead(img, t, &snap[t]) < 0) {
+                fprintf(stderr, "ldpi isn't updating the image\n");
+                return 1;
+            }
+        }
+        for(i = 0; i < n; i++) {
+            const LdpiImageSymbol *s = &img->symbols[want[i]];
+            printf("%s%s%s %d\n", img->taskCount > 1 ?
+                img->tasks[s->task].fileName : "", img->taskCount > 1 ?
+                ":" : "", s->name, LdpiImageValue(&snap[s->task], s));
+        }
+        printf("cycles %llu\n", snap[0].cycles);
+        if(!ms || !img->pid) break;
+        fflush(stdout);
+        usleep(ms*1000);
+    }
+    LdpiImageClose(img);
+    return 0;
+}
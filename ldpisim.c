@@ -0,0 +1,118 @@
+//-----------------------------------------------------------------------------
+// A small tool to drive ldpi's simulated I/O (--io=sim) from the command
+// line or a test script:
+//
+//      $ ./ldpisim set 3 1         set input GPI3
+//      $ ./ldpisim get 1           print output GPO1
+//      $ ./ldpisim wait 1 1 500    wait up to 500 ms for GPO1 to be set
+//      $ ./ldpisim show            print all of the pins in use
+//
+// Use -n name for a shared-memory object other than /ldpi.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "ldpisim.h"
+
+#define BIT(w, n)               (((w)[(n) / 32] >> ((n) % 32)) & 1)
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: ldpisim [-n name] show\n"
+                    "       ldpisim [-n name] set pin value\n"
+                    "       ldpisim [-n name] get pin\n"
+                    "       ldpisim [-n name] wait pin value [timeout_ms]\n");
+    exit(-1);
+}
+
+static LdpiSim *Open(const char *name, int create)
+{
+    LdpiSim *sim;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0666);
+    if(fd < 0 || (create && ftruncate(fd, sizeof(LdpiSim)) != 0)) {
+        perror(name);
+        exit(-1);
+    }
+    sim = mmap(NULL, sizeof(LdpiSim), PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    close(fd);
+    if(sim == MAP_FAILED) {
+        perror("mmap");
+        exit(-1);
+    }
+    return sim;
+}
+
+static int Pin(const char *s)
+{
+    int pin = atoi(s);
+    if(pin < 0 || pin >= LDPI_SIM_WORDS*32) Usage();
+    return pin;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = LDPI_SIM_DEFAULT;
+    LdpiSim *sim;
+    int c, pin;
+
+    while((c = getopt(argc, argv, "n:")) != -1) {
+        if(c == 'n') name = optarg; else Usage();
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc < 1) Usage();
+
+    // Inputs may be set before ldpi is started.
+    sim = Open(name, strcmp(argv[0], "set") == 0);
+
+    if(strcmp(argv[0], "set") == 0 && argc == 3) {
+        unsigned m, old;
+        pin = Pin(argv[1]);
+        m = 1u << (pin % 32);
+        if(atoi(argv[2])) {
+            old = __atomic_fetch_or(&sim->inputs[pin / 32], m,
+                __ATOMIC_RELEASE);
+            if(!(old & m)) LdpiSimEdge(sim);
+        } else {
+            old = __atomic_fetch_and(&sim->inputs[pin / 32], ~m,
+                __ATOMIC_RELEASE);
+            if(old & m) LdpiSimEdge(sim);
+        }
+    } else if(strcmp(argv[0], "get") == 0 && argc == 2) {
+        pin = Pin(argv[1]);
+        printf("%d\n", BIT(sim->outputs, pin));
+    } else if(strcmp(argv[0], "wait") == 0 && (argc == 3 || argc == 4)) {
+        int want = atoi(argv[2]) ? 1 : 0;
+        long ms = argc == 4 ? atol(argv[3]) : -1;
+        pin = Pin(argv[1]);
+        while(BIT(sim->outputs, pin) != want) {
+            if(ms == 0) return 1;
+            usleep(1000);
+            if(ms > 0) ms--;
+        }
+    } else if(strcmp(argv[0], "show") == 0 && argc == 1) {
+        if(sim->magic != LDPI_SIM_MAGIC) {
+            fprintf(stderr, "%s: ldpi has not set this up yet\n", name);
+            return 1;
+        }
+        for(pin = 0; pin < LDPI_SIM_WORDS*32; pin++) {
+            if(BIT(sim->inputPins, pin)) {
+                printf("GPI%d %d\n", pin, BIT(sim->inputs, pin));
+            }
+            if(BIT(sim->outputPins, pin)) {
+                printf("GPO%d %d\n", pin, BIT(sim->outputs, pin));
+            }
+        }
+        printf("reads %llu writes %llu\n", sim->reads, sim->writes);
+    } else {
+        Usage();
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+//-----------------------------------------------------------------------------
+// The layout of the shared-memory segment used by ldpi's simulated I/O
+// backend (--io=sim). A test harness opens the same POSIX shared-memory
+// object (shm_open(), "/ldpi" unless another name was given), maps it, and
+// then drives the inputs and watches the outputs; ldpisim is a small command
+// line tool that does just that.
+//
+// Pin n is bit (n % 32) of word (n / 32). All of the fields should be read
+// and written with atomic loads and stores; the inputs only ever change
+// when the harness writes them, and the outputs when ldpi does.
+//
+// When the harness changes an input it should also note the time in
+// inputTime (unless that is already set), bump inputSeq, and FUTEX_WAKE
+// anyone waiting on it, so that ldpi can react to the edge (--react) and
+// time it (--latency); LdpiSimEdge() does all of that.
+//-----------------------------------------------------------------------------
+#ifndef __LDPISIM_H
+#define __LDPISIM_H
+
+#define LDPI_SIM_MAGIC          0x6c647073      // 'ldps'
+#define LDPI_SIM_VERSION        2
+#define LDPI_SIM_DEFAULT        "/ldpi"
+#define LDPI_SIM_WORDS          4               // room for 128 pins
+
+typedef struct {
+    unsigned            magic;
+    unsigned            version;
+
+    // Written by the harness.
+    unsigned            inputs[LDPI_SIM_WORDS];
+
+    // Written by ldpi.
+    unsigned            outputs[LDPI_SIM_WORDS];
+    unsigned            inputPins[LDPI_SIM_WORDS];  // which pins ldpi reads
+    unsigned            outputPins[LDPI_SIM_WORDS]; // and which it writes
+    unsigned long long  reads;      // count of times the inputs were read
+    unsigned long long  writes;     // and the outputs written
+
+    // Written by the harness, and taken by ldpi, as above.
+    unsigned            inputSeq;
+    long long           inputTime;  // CLOCK_MONOTONIC ns, or 0
+} LdpiSim;
+
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Tell ldpi that the harness has just changed an input.
+static inline void LdpiSimEdge(LdpiSim *sim)
+{
+    struct timespec now;
+    long long none = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    __atomic_compare_exchange_n(&sim->inputTime, &none,
+        now.tv_sec*1000000000LL + now.tv_nsec, 0, __ATOMIC_RELEASE,
+        __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sim->inputSeq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &sim->inputSeq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#endif
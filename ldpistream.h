@@ -0,0 +1,50 @@
+//-----------------------------------------------------------------------------
+// What ldpi sends to the subscribers of its change stream (--stream). A
+// client connects to the UNIX socket (/tmp/ldpi-stream.sock by default) and
+// sends a line naming the variables it wants, as "name" or "file:name", or
+// * for all of them:
+//
+//      subscribe Tcnt YGPO1
+//
+// and gets back a line for each of them, giving the index by which the
+// stream will refer to it, and then "ok" and the number of them:
+//
+//      var 0 Tcnt int
+//      var 1 YGPO1 bit
+//      ok 2
+//
+// (or "error: ..." and nothing else, after which the client may try
+// again). From then on the socket carries nothing but frames, each a header
+// followed by count entries, and anything more that the client sends is
+// ignored; to change what it gets, it connects again.
+// The first frame has every newly subscribed variable in it; after that,
+// one frame per scan of a task that changed any of them, with just the ones
+// that changed. An entry is one WORD: the variable's index, with the top bit
+// set for a bit that is set; an integer's WORD is followed by its value, as
+// a SWORD. Everything is in the machine's own byte order.
+//
+// The scans never wait for a subscriber. If one falls behind, whatever
+// changed in the meantime is sent as one frame, with the newest values and
+// LDPI_STREAM_COALESCED set; one that takes nothing for a couple of seconds
+// is disconnected.
+//-----------------------------------------------------------------------------
+#ifndef __LDPISTREAM_H
+#define __LDPISTREAM_H
+
+#define LDPI_STREAM_DEFAULT     "/tmp/ldpi-stream.sock"
+
+// The frame covers more than one scan (the values are from the last).
+#define LDPI_STREAM_COALESCED   0x01
+
+#define LDPI_STREAM_VALUE       0x8000  // in an entry: the bit is set
+
+typedef struct {
+    unsigned short      size;       // of the whole frame, this included
+    unsigned char       flags;
+    unsigned char       task;
+    unsigned short      count;      // entries
+    unsigned short      reserved;
+    unsigned long long  cycle;      // the task's scan count
+} LdpiStreamHeader;
+
+#endif
@@ -0,0 +1,48 @@
+//-----------------------------------------------------------------------------
+// The frames that ldpi's remote I/O backend (--io=udp) exchanges with a
+// remote I/O node, one UDP datagram each way per scan:
+//
+//      ldpi -> node    LDPI_UDP_OUTPUTS: every output, and which pins ldpi
+//                      reads and writes
+//      node -> ldpi    LDPI_UDP_INPUTS: every input, in answer to an
+//                      outputs frame, and carrying its seq
+//
+// ldpi numbers its outputs frames, and only takes an inputs frame that
+// answers a later one than the last it took, so a late or duplicated
+// datagram can never take the inputs back in time. A node that hears
+// nothing from ldpi for its timeout must put its outputs into their safe
+// state (off) until ldpi is heard from again, and says so with
+// LDPI_UDP_SAFE in its answers. ldpinode is a node to test with, that keeps
+// its pins in a shared-memory segment like --io=sim's.
+//
+// All fields are in network byte order.
+//-----------------------------------------------------------------------------
+#ifndef __LDPIUDP_H
+#define __LDPIUDP_H
+
+#define LDPI_UDP_MAGIC          0x6c647075      // 'ldpu'
+#define LDPI_UDP_VERSION        1
+#define LDPI_UDP_PORT           5020
+#define LDPI_UDP_WORDS          2               // room for 64 pins
+
+// Frame types.
+#define LDPI_UDP_OUTPUTS        1
+#define LDPI_UDP_INPUTS         2
+
+// Flags in an inputs frame.
+#define LDPI_UDP_SAFE           0x01    // the outputs are in the safe state
+
+typedef struct {
+    unsigned            magic;
+    unsigned short      version;
+    unsigned short      type;
+    unsigned            seq;
+    unsigned            flags;
+    // Pin n is bit (n % 32) of word (n / 32): the outputs, or the inputs.
+    unsigned            pins[LDPI_UDP_WORDS];
+    // In an outputs frame, the pins that ldpi writes and reads.
+    unsigned            outputPins[LDPI_UDP_WORDS];
+    unsigned            inputPins[LDPI_UDP_WORDS];
+} LdpiUdpFrame;
+
+#endif
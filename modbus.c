@@ -0,0 +1,423 @@
+//-----------------------------------------------------------------------------
+// A Modbus TCP server for ldpi, so that a SCADA system (or anything else
+// that speaks Modbus) can watch and set the ladder's variables:
+//
+//      coils and discrete inputs   Bits[addr]
+//      holding and input registers Integers[addr]
+//
+// where addr is the address given for the variable in the .int file's
+// symbol table (which ldpi prints when it loads the program). The unit id
+// picks the program: 1 for the first one on the command line after sorting
+// by cycle time (that is, the fastest), 2 for the next, and so on; 0 and
+// 255 also mean the first. Use it with
+//
+//      --modbus[=[addr:]port]
+//
+// (port 502 on all addresses by default, which needs root).
+//
+// The server runs on its own thread, at ordinary priority, with an epoll
+// loop over all of the client connections, and it never touches a task's
+// variables itself. It answers reads from the process image (see image.c),
+// which each task updates at the end of every scan, so a reply always
+// comes from one whole scan. Writes go into the task's command queue (see
+// command.c), which the scan thread empties at the start of its next scan;
+// if the queue is full the client gets a 'server busy' exception rather
+// than the scan thread waiting.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "image.h"
+#include "command.h"
+#include "modbus.h"
+
+#define MODBUS_PORT             502
+#define MODBUS_MAX_ADU          260     // the biggest frame Modbus allows
+#define MODBUS_RX               1024
+#define MODBUS_TX               4096
+
+// Exception codes.
+#define MB_ILLEGAL_FUNCTION     0x01
+#define MB_ILLEGAL_ADDRESS      0x02
+#define MB_ILLEGAL_VALUE        0x03
+#define MB_SERVER_BUSY          0x06
+#define MB_TARGET_FAILED        0x0b
+
+int Modbus;
+unsigned long long ModbusRequests, ModbusExceptions;
+unsigned long ModbusClients, ModbusRejected;
+
+static char ListenAddr[64];
+static int ListenPort = MODBUS_PORT;
+
+typedef struct {
+    int         fd;
+    int         rxLen;
+    int         txLen, txOff;
+    unsigned    events;     // what epoll is watching for
+    BYTE        rx[MODBUS_RX];
+    BYTE        tx[MODBUS_TX];
+} Client;
+
+static int Listener = -1, Epoll = -1;
+static pthread_t Thread;
+
+void ModbusConfigure(const char *spec)
+{
+    const char *colon;
+
+    Modbus = 1;
+    if(!spec) return;
+    if((colon = strrchr(spec, ':'))) {
+        snprintf(ListenAddr, sizeof(ListenAddr), "%.*s", (int)(colon - spec),
+            spec);
+        spec = colon + 1;
+    }
+    ListenPort = atoi(spec);
+    if(ListenPort <= 0 || ListenPort > 65535) {
+        fprintf(stderr, "--modbus: bad port '%s'\n", spec);
+        exit(-1);
+    }
+}
+
+static unsigned Get16(const BYTE *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void Put16(BYTE *p, unsigned v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+// Handle one request PDU, req[0..len), for task, building the reply PDU in
+// rsp[]; returns the reply's length, or an exception code negated.
+static int HandlePdu(int task, const BYTE *req, int len, BYTE *rsp)
+{
+    static Command w[MAX_INTERNAL_RELAYS];
+    static LdpiImageTask snap;
+    unsigned fc = req[0], start, qty, i;
+
+    // Every function that we know starts with an address and a quantity
+    // (or a value); anything else is refused before its length matters.
+    switch(fc) {
+        case 1: case 2: case 3: case 4: case 5: case 6: case 15: case 16:
+            break;
+        default:
+            return -MB_ILLEGAL_FUNCTION;
+    }
+    if(len < 5) return -MB_ILLEGAL_VALUE;
+    start = Get16(req + 1);
+    qty = Get16(req + 3);
+    rsp[0] = fc;
+
+    switch(fc) {
+        case 1:     // read coils
+        case 2:     // read discrete inputs
+            if(qty < 1 || qty > 2000) return -MB_ILLEGAL_VALUE;
+            if(start + qty > MAX_INTERNAL_RELAYS) return -MB_ILLEGAL_ADDRESS;
+            if(LdpiImageRead(Image, task, &snap) < 0) return -MB_SERVER_BUSY;
+            rsp[1] = (qty + 7) / 8;
+            memset(rsp + 2, 0, rsp[1]);
+            for(i = 0; i < qty; i++) {
+                if(snap.bits[start + i]) rsp[2 + i/8] |= 1 << (i % 8);
+            }
+            return 2 + rsp[1];
+
+        case 3:     // read holding registers
+        case 4:     // read input registers
+            if(qty < 1 || qty > 125) return -MB_ILLEGAL_VALUE;
+            if(start + qty > MAX_VARIABLES) return -MB_ILLEGAL_ADDRESS;
+            if(LdpiImageRead(Image, task, &snap) < 0) return -MB_SERVER_BUSY;
+            rsp[1] = 2*qty;
+            for(i = 0; i < qty; i++) {
+                Put16(rsp + 2 + 2*i, (WORD)snap.integers[start + i]);
+            }
+            return 2 + rsp[1];
+
+        case 5:     // write single coil
+            if(qty != 0xff00 && qty != 0) return -MB_ILLEGAL_VALUE;
+            if(start >= MAX_INTERNAL_RELAYS) return -MB_ILLEGAL_ADDRESS;
+            w[0].op = CMD_WRITE;
+            w[0].addr = start;
+            w[0].isInt = 0;
+            w[0].value = qty ? 1 : 0;
+            if(!CommandPost(task, w, 1)) return -MB_SERVER_BUSY;
+            memcpy(rsp, req, 5);
+            return 5;
+
+        case 6:     // write single register
+            if(start >= MAX_VARIABLES) return -MB_ILLEGAL_ADDRESS;
+            w[0].op = CMD_WRITE;
+            w[0].addr = start;
+            w[0].isInt = 1;
+            w[0].value = (SWORD)qty;
+            if(!CommandPost(task, w, 1)) return -MB_SERVER_BUSY;
+            memcpy(rsp, req, 5);
+            return 5;
+
+        case 15:    // write multiple coils
+            if(qty < 1 || qty > 1968 || len < 6 || req[5] != (qty + 7)/8 ||
+                len < 6 + req[5])
+            {
+                return -MB_ILLEGAL_VALUE;
+            }
+            if(start + qty > MAX_INTERNAL_RELAYS) return -MB_ILLEGAL_ADDRESS;
+            for(i = 0; i < qty; i++) {
+                w[i].op = CMD_WRITE;
+                w[i].addr = start + i;
+                w[i].isInt = 0;
+                w[i].value = (req[6 + i/8] >> (i % 8)) & 1;
+            }
+            if(!CommandPost(task, w, qty)) return -MB_SERVER_BUSY;
+            memcpy(rsp, req, 5);
+            return 5;
+
+        case 16:    // write multiple registers
+            if(qty < 1 || qty > 123 || len < 6 || req[5] != 2*qty ||
+                len < 6 + req[5])
+            {
+                return -MB_ILLEGAL_VALUE;
+            }
+            if(start + qty > MAX_VARIABLES) return -MB_ILLEGAL_ADDRESS;
+            for(i = 0; i < qty; i++) {
+                w[i].op = CMD_WRITE;
+                w[i].addr = start + i;
+                w[i].isInt = 1;
+                w[i].value = (SWORD)Get16(req + 6 + 2*i);
+            }
+            if(!CommandPost(task, w, qty)) return -MB_SERVER_BUSY;
+            memcpy(rsp, req, 5);
+            return 5;
+    }
+    return -MB_ILLEGAL_FUNCTION;
+}
+
+static void Watch(Client *c, unsigned events)
+{
+    struct epoll_event ev;
+
+    if(events == c->events) return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(Epoll, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+static void Close(Client *c)
+{
+    close(c->fd);
+    free(c);
+    ModbusClients--;
+}
+
+// Answer every complete request in the receive buffer, as long as there is
+// room for the replies. Returns how many bytes of requests were used up,
+// or -1 if the client sent garbage.
+static int Process(Client *c)
+{
+    int off = 0;
+
+    while(c->rxLen - off >= 7 && MODBUS_TX - c->txLen >= MODBUS_MAX_ADU) {
+        const BYTE *req = c->rx + off;
+        BYTE *rsp = c->tx + c->txLen;
+        int len = Get16(req + 4), unit = req[6], task, n;
+
+        if(Get16(req + 2) != 0 || len < 2 || len > MODBUS_MAX_ADU - 6) {
+            return -1;
+        }
+        if(c->rxLen - off < 6 + len) break;
+
+        task = (unit == 0 || unit == 255) ? 0 : unit - 1;
+        if(task >= NumTasks) {
+            n = -MB_TARGET_FAILED;
+        } else {
+            n = HandlePdu(task, req + 7, len - 1, rsp + 7);
+        }
+        if(n < 0) {
+            rsp[7] = req[7] | 0x80;
+            rsp[8] = -n;
+            n = 2;
+            ModbusExceptions++;
+        }
+        memcpy(rsp, req, 4);        // transaction and protocol ids
+        Put16(rsp + 4, n + 1);
+        rsp[6] = unit;
+        c->txLen += 7 + n;
+        off += 6 + len;
+        ModbusRequests++;
+    }
+    memmove(c->rx, c->rx + off, c->rxLen - off);
+    c->rxLen -= off;
+    return off;
+}
+
+// Send what we can; returns -1 if the connection has gone.
+static int Flush(Client *c)
+{
+    while(c->txOff < c->txLen) {
+        int n = send(c->fd, c->tx + c->txOff, c->txLen - c->txOff,
+            MSG_NOSIGNAL);
+        if(n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        c->txOff += n;
+    }
+    c->txOff = c->txLen = 0;
+    return 0;
+}
+
+static void Service(Client *c, unsigned events)
+{
+    int n;
+
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        Close(c);
+        return;
+    }
+    if(events & EPOLLOUT) {
+        if(Flush(c) < 0) {
+            Close(c);
+            return;
+        }
+    }
+    if(events & EPOLLIN) {
+        n = recv(c->fd, c->rx + c->rxLen, MODBUS_RX - c->rxLen, 0);
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            Close(c);
+            return;
+        }
+        if(n > 0) c->rxLen += n;
+    }
+    // A client may send several requests without waiting for the replies,
+    // so keep going for as long as the replies can be sent straight away.
+    do {
+        if((n = Process(c)) < 0 || Flush(c) < 0) {
+            Close(c);
+            return;
+        }
+    } while(n > 0 && !c->txLen && c->rxLen);
+
+    // Stop reading while the replies aren't being taken, so that a client
+    // that never reads can't make us buffer without end.
+    Watch(c, (c->txLen ? EPOLLOUT : 0) |
+        (c->rxLen < MODBUS_RX && !c->txLen ? EPOLLIN : 0));
+}
+
+static void Accept(void)
+{
+    struct epoll_event ev;
+    Client *c;
+    int fd, one = 1;
+
+    while((fd = accept4(Listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))
+        >= 0)
+    {
+        if(!(c = calloc(1, sizeof(*c)))) {
+            close(fd);
+            ModbusRejected++;
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->fd = fd;
+        c->events = EPOLLIN;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if(epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+            ModbusRejected++;
+            continue;
+        }
+        ModbusClients++;
+    }
+    if(errno == EMFILE || errno == ENFILE) ModbusRejected++;
+}
+
+static void *ModbusThread(void *arg)
+{
+    struct epoll_event ev[64];
+    int i, n;
+
+    for(;;) {
+        n = epoll_wait(Epoll, ev, 64, -1);
+        for(i = 0; i < n; i++) {
+            if(ev[i].data.ptr == NULL) {
+                Accept();
+            } else {
+                Service(ev[i].data.ptr, ev[i].events);
+            }
+        }
+    }
+    return NULL;
+}
+
+void ModbusStart(void)
+{
+    struct sockaddr_in sa;
+    struct epoll_event ev;
+    pthread_attr_t attr;
+    struct rlimit rl;
+    int one = 1, i;
+
+    // Allow as many clients as the hard limit on open files does.
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(ListenPort);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(ListenAddr[0] && inet_pton(AF_INET, ListenAddr, &sa.sin_addr) != 1) {
+        fprintf(stderr, "--modbus: bad address '%s'\n", ListenAddr);
+        exit(-1);
+    }
+
+    Listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    setsockopt(Listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(Listener < 0 || bind(Listener, (struct sockaddr *)&sa, sizeof(sa)) < 0
+        || listen(Listener, 512) < 0)
+    {
+        perror("--modbus");
+        exit(-1);
+    }
+
+    Epoll = epoll_create1(EPOLL_CLOEXEC);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Listener, &ev);
+
+    printf("Modbus TCP server on %s:%d", ListenAddr[0] ? ListenAddr : "*",
+        ListenPort);
+    for(i = 0; i < NumTasks; i++) {
+        printf("%s unit %d = %s", i ? "," : ";", i + 1, Tasks[i].fileName);
+    }
+    printf("\n");
+
+    // At ordinary priority, and anywhere, so that it never gets in the way
+    // of a scan.
+    RtThreadAttr(&attr, 0, -1);
+    if(pthread_create(&Thread, &attr, ModbusThread, NULL) != 0) {
+        perror("--modbus");
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+}
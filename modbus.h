@@ -0,0 +1,19 @@
+//-----------------------------------------------------------------------------
+// The Modbus TCP server for ldpi; see modbus.c.
+//-----------------------------------------------------------------------------
+#ifndef __MODBUS_H
+#define __MODBUS_H
+
+#include "ldpi.h"
+
+extern int Modbus;              // nonzero for --modbus
+extern unsigned long long ModbusRequests, ModbusExceptions;
+extern unsigned long ModbusClients, ModbusRejected;
+
+// Take a --modbus[=[addr:]port] option.
+void ModbusConfigure(const char *spec);
+
+// Open the listening socket and start the server thread.
+void ModbusStart(void);
+
+#endif
@@ -0,0 +1,160 @@
+//-----------------------------------------------------------------------------
+// The pipelined I/O thread for ldpi. Normally the fastest task reads the
+// pins, runs its ladder and writes the pins one after the other, so slow
+// I/O (an I2C expander, say) adds directly to the scan time. With
+// --pipeline, a separate I/O thread does the reading and writing, and the
+// ladder only swaps images with it:
+//
+//      I/O thread:  | write outs(k-1), read ins(k) |       | write outs(k) ...
+//      ladder:                      | scan(k) on ins(k) |
+//                   ^ kP            ^ kP + P/2           ^ (k+1)P
+//
+// The I/O thread is released at the start of each period and the ladder
+// half a period later, so the outputs computed from the inputs sampled in
+// period k are written at the start of period k+1: one whole cycle from
+// input to output, where it used to be about one scan time. In exchange the
+// cycle only has to be as long as the slower of the I/O and the ladder,
+// rather than the two added together.
+//
+// The images are handed over through triple buffers, which is double
+// buffering with a spare so that neither side ever waits: the writer fills
+// its own buffer and swaps it with the shared middle one, and the reader
+// swaps its own buffer with the middle one when there is something new in
+// it. If the I/O is late the ladder just runs on the previous inputs.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "pipeline.h"
+#include "io.h"
+
+int Pipeline;
+int PipelineCpu = -1;
+ScanStats PipelineStats;
+unsigned long PipelineMissed;
+
+#define TB_FRESH                4
+
+typedef struct {
+    IoWord      buf[3][IO_WORDS];
+    int         middle;     // index of the shared buffer, | TB_FRESH
+    int         back;       // the writer's buffer
+    int         front;      // the reader's buffer
+} TripleBuffer;
+
+static TripleBuffer Inputs, Outputs;
+static pthread_t IoThread;
+static long long IoPeriod;
+
+static void TbInit(TripleBuffer *tb)
+{
+    memset(tb, 0, sizeof(*tb));
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+}
+
+// The writer side: fill TbBack(), then TbPublish().
+static IoWord *TbBack(TripleBuffer *tb)
+{
+    return tb->buf[tb->back];
+}
+
+static void TbPublish(TripleBuffer *tb)
+{
+    tb->back = __atomic_exchange_n(&tb->middle, tb->back | TB_FRESH,
+        __ATOMIC_ACQ_REL) & ~TB_FRESH;
+}
+
+// The reader side: TbFetch() to pick up anything new, then read TbFront().
+static int TbFetch(TripleBuffer *tb)
+{
+    if(!(__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & TB_FRESH)) return 0;
+    tb->front = __atomic_exchange_n(&tb->middle, tb->front,
+        __ATOMIC_ACQ_REL) & ~TB_FRESH;
+    return 1;
+}
+
+static const IoWord *TbFront(TripleBuffer *tb)
+{
+    return tb->buf[tb->front];
+}
+
+void PipelineGetInputs(IoWord *in)
+{
+    TbFetch(&Inputs);
+    memcpy(in, TbFront(&Inputs), IO_WORDS*sizeof(IoWord));
+}
+
+void PipelinePutOutputs(const IoWord *out)
+{
+    memcpy(TbBack(&Outputs), out, IO_WORDS*sizeof(IoWord));
+    TbPublish(&Outputs);
+}
+
+static void *IoThreadMain(void *arg)
+{
+    struct timespec next = StartTime, t0, t1, t2;
+    int haveOutputs = 0;
+
+    if(Realtime) RtPrefaultStack();
+
+    while(Running) {
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL)
+            == EINTR)
+            ;
+
+        // Until the ladder has run once there is nothing to write.
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(TbFetch(&Outputs)) haveOutputs = 1;
+        if(haveOutputs) IoWriteOutputs(TbFront(&Outputs));
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        IoReadInputs(TbBack(&Inputs));
+        TbPublish(&Inputs);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        HistRecord(&PipelineStats.wake, TimespecDiffNs(&t0, &next));
+        HistRecord(&PipelineStats.out, TimespecDiffNs(&t1, &t0));
+        HistRecord(&PipelineStats.in, TimespecDiffNs(&t2, &t1));
+        HistRecord(&PipelineStats.scan, TimespecDiffNs(&t2, &t0));
+        HistRecord(&PipelineStats.span, TimespecDiffNs(&t2, &next));
+        PipelineStats.scans++;
+
+        TimespecAddNs(&next, IoPeriod);
+        if(TimespecDiffNs(&t2, &next) >= 0) {
+            long long missed = TimespecDiffNs(&t2, &next)/IoPeriod + 1;
+            PipelineStats.overruns++;
+            PipelineMissed += missed;
+            TimespecAddNs(&next, missed*IoPeriod);
+            LogPrintf("I/O thread overrun, %lld period(s) dropped\n", missed);
+        }
+    }
+    return NULL;
+}
+
+void PipelineStart(long long period, int priority)
+{
+    pthread_attr_t attr;
+    int err;
+
+    TbInit(&Inputs);
+    TbInit(&Outputs);
+    IoPeriod = period;
+
+    RtThreadAttr(&attr, priority, PipelineCpu);
+    if((err = pthread_create(&IoThread, &attr, IoThreadMain, NULL)) != 0) {
+        fprintf(stderr, "couldn't start I/O thread: %s\n", strerror(err));
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void PipelineStop(void)
+{
+    pthread_join(IoThread, NULL);
+}
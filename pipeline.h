@@ -0,0 +1,23 @@
+//-----------------------------------------------------------------------------
+// The pipelined I/O thread for ldpi; see pipeline.c.
+//-----------------------------------------------------------------------------
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include "ldpi.h"
+
+extern int Pipeline;            // nonzero for --pipeline
+extern int PipelineCpu;         // CPU for the I/O thread, or -1
+extern ScanStats PipelineStats;
+extern unsigned long PipelineMissed;
+
+// Start the I/O thread, running every period ns from StartTime.
+void PipelineStart(long long period, int priority);
+void PipelineStop(void);
+
+// Called by the task that does the I/O, instead of touching the pins: get
+// the most recently sampled inputs, and hand over the outputs to be written.
+void PipelineGetInputs(IoWord *in);
+void PipelinePutOutputs(const IoWord *out);
+
+#endif
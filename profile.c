@@ -0,0 +1,218 @@
+//-----------------------------------------------------------------------------
+// The execution profile for ldpi. With --profile the scans run
+// InterpretProfiled() instead of InterpretOneCycle(): the same interpreter,
+// compiled a second time with the counting switched on (see ldpi.c), so
+// that without --profile the interpreter is exactly what it was, and costs
+// nothing more. The profiling one counts how often each pc runs, and reads
+// the cycle counter at the start of each rung, to add the time since the
+// last reading to the rung before.
+//
+// The .int file doesn't say where the rungs are, so they are worked out
+// from the program. LDmicro starts every rung by setting $rung_top, at the
+// top level (outside any IF); so a rung starts at each top-level write of
+// $rung_top, or, if there is no such symbol, of whatever bit the first
+// instruction sets. Failing that, each top-level statement is a rung of its
+// own. Rung 1 starts at pc 0.
+//
+// The report, printed at exit (and with the full statistics on SIGUSR1, when
+// the counts may be a scan or so out of step with each other), lists the
+// rungs, the opcodes and then the program as Disassemble() does, each with
+// the hottest first.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INTCODE_H_CONSTANTS_ONLY
+#include "intcode.h"
+#include "ldpi.h"
+#include "profile.h"
+
+int Profiling;
+
+static double TicksPerNs;
+
+static const struct {
+    int         op;
+    const char *name;
+} OpNames[] = {
+    { INT_SET_BIT,                      "set bit" },
+    { INT_CLEAR_BIT,                    "clear bit" },
+    { INT_COPY_BIT_TO_BIT,              "copy bit" },
+    { INT_SET_VARIABLE_TO_LITERAL,      "set to literal" },
+    { INT_SET_VARIABLE_TO_VARIABLE,     "set to variable" },
+    { INT_INCREMENT_VARIABLE,           "increment" },
+    { INT_SET_VARIABLE_ADD,             "add" },
+    { INT_SET_VARIABLE_SUBTRACT,        "subtract" },
+    { INT_SET_VARIABLE_MULTIPLY,        "multiply" },
+    { INT_SET_VARIABLE_DIVIDE,          "divide" },
+    { INT_READ_ADC,                     "read adc" },
+    { INT_SET_PWM,                      "set pwm" },
+    { INT_UART_SEND,                    "uart send" },
+    { INT_UART_RECV,                    "uart recv" },
+    { INT_EEPROM_BUSY_CHECK,            "eeprom busy" },
+    { INT_EEPROM_READ,                  "eeprom read" },
+    { INT_EEPROM_WRITE,                 "eeprom write" },
+    { INT_IF_BIT_SET,                   "if bit set" },
+    { INT_IF_BIT_CLEAR,                 "if bit clear" },
+    { INT_IF_VARIABLE_LES_LITERAL,      "if less than literal" },
+    { INT_IF_VARIABLE_EQUALS_VARIABLE,  "if equal" },
+    { INT_IF_VARIABLE_GRT_VARIABLE,     "if greater" },
+    { INT_ELSE,                         "else" },
+    { INT_END_OF_PROGRAM,               "end of program" },
+    { 0, NULL }
+};
+
+// How fast ProfileTicks() counts, against CLOCK_MONOTONIC.
+static void Calibrate(void)
+{
+    struct timespec a, b, nap = { 0, 20*1000000 };
+    unsigned long long ta, tb;
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    ta = ProfileTicks();
+    nanosleep(&nap, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    tb = ProfileTicks();
+    TicksPerNs = (double)(tb - ta)/TimespecDiffNs(&b, &a);
+}
+
+void ProfileInit(Task *t)
+{
+    Profile *prof;
+    WORD ends[MAX_OPS];
+    int pc, k, depth = 0, rungTop = -1;
+
+    if(!TicksPerNs) Calibrate();
+    if(!(prof = calloc(1, sizeof(Profile)))) {
+        fprintf(stderr, "out of memory for the profile\n");
+        exit(-1);
+    }
+
+    for(k = 0; k < t->symbolCount; k++) {
+        if(!t->symbols[k].isInt &&
+            strcmp(t->symbols[k].name, "$rung_top") == 0)
+        {
+            rungTop = t->symbols[k].addr;
+        }
+    }
+    if(rungTop < 0 && t->program[0].op == INT_SET_BIT) {
+        rungTop = t->program[0].name1;
+    }
+
+    // An IF at pc skips to after name3, so pc+1..name3 is inside it; and
+    // likewise an ELSE for its own block. Anything else is at the top.
+    for(pc = 0; ; pc++) {
+        const BinOp *p = &t->program[pc];
+
+        while(depth > 0 && ends[depth - 1] < pc) depth--;
+        if(pc > 0 && depth == 0 && (rungTop < 0 ||
+            (p->op == INT_SET_BIT && p->name1 == rungTop)))
+        {
+            prof->rungStart[pc] = 1;
+            prof->rungPc[++prof->rungs] = pc;
+        }
+        prof->rungOf[pc] = prof->rungs;
+        if(p->op == INT_END_OF_PROGRAM) break;
+        if((INT_IF_GROUP(p->op) || p->op == INT_ELSE) && depth < MAX_OPS) {
+            ends[depth++] = p->name3;
+        }
+    }
+    // The END itself isn't a statement.
+    if(rungTop < 0 && prof->rungStart[pc]) {
+        prof->rungStart[pc] = 0;
+        prof->rungOf[pc] = --prof->rungs;
+    }
+    prof->rungs++;
+    prof->ops = pc + 1;
+    t->profile = prof;
+}
+
+//-----------------------------------------------------------------------------
+// The report.
+//-----------------------------------------------------------------------------
+static const unsigned long long *SortBy;
+
+static int Hotter(const void *a, const void *b)
+{
+    unsigned long long x = SortBy[*(const int *)a];
+    unsigned long long y = SortBy[*(const int *)b];
+
+    if(x != y) return x < y ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+static void SortHotFirst(int *order, int n, const unsigned long long *by)
+{
+    int i;
+
+    for(i = 0; i < n; i++) order[i] = i;
+    SortBy = by;
+    qsort(order, n, sizeof(int), Hotter);
+}
+
+static const char *OpName(int op)
+{
+    int i;
+
+    for(i = 0; OpNames[i].name; i++) {
+        if(OpNames[i].op == op) return OpNames[i].name;
+    }
+    return "?";
+}
+
+void ProfileReport(const Task *t)
+{
+    const Profile *prof = t->profile;
+    unsigned long long scans, total = 0, executed = 0, runs, byOp[256];
+    int order[MAX_OPS], i, pc, unused = 0;
+
+    if(!prof) return;
+    scans = prof->count[0];
+    for(i = 0; i < prof->rungs; i++) total += prof->ticks[i];
+    memset(byOp, 0, sizeof(byOp));
+    for(pc = 0; pc < prof->ops; pc++) {
+        byOp[t->program[pc].op & 0xff] += prof->count[pc];
+        executed += prof->count[pc];
+    }
+    if(!total) total = 1;
+    if(!executed) executed = 1;
+
+    printf("profile of %s: %llu scans, %.3f ms in the program (%.0f ns a "
+        "scan)\n", t->fileName, scans, total/TicksPerNs/1e6,
+        scans ? total/TicksPerNs/scans : 0);
+
+    printf("  rung    pc          runs    ns/run   total ms       %%\n");
+    SortHotFirst(order, prof->rungs, prof->ticks);
+    for(i = 0; i < prof->rungs; i++) {
+        int r = order[i];
+        runs = prof->count[prof->rungPc[r]];
+        printf("  %4d   %03x  %12llu  %8.1f  %9.3f  %6.2f\n", r + 1,
+            prof->rungPc[r], runs,
+            runs ? prof->ticks[r]/TicksPerNs/runs : 0,
+            prof->ticks[r]/TicksPerNs/1e6, 100.0*prof->ticks[r]/total);
+    }
+
+    printf("  opcode                         count       %%\n");
+    SortHotFirst(order, 256, byOp);
+    for(i = 0; i < 256 && byOp[order[i]]; i++) {
+        printf("  %-20s  %14llu  %6.2f\n", OpName(order[i]), byOp[order[i]],
+            100.0*byOp[order[i]]/executed);
+    }
+
+    printf("          count       %%  rung   pc: instruction\n");
+    SortHotFirst(order, prof->ops, prof->count);
+    for(i = 0; i < prof->ops; i++) {
+        pc = order[i];
+        if(!prof->count[pc]) {
+            unused++;
+            continue;
+        }
+        printf("  %13llu  %6.2f  %4d  %03x: ", prof->count[pc],
+            100.0*prof->count[pc]/executed, prof->rungOf[pc] + 1, pc);
+        DisassembleOp(&t->program[pc]);
+        printf("\n");
+    }
+    if(unused) printf("  (%d instructions never ran)\n", unused);
+}
@@ -0,0 +1,53 @@
+//-----------------------------------------------------------------------------
+// The execution profile for ldpi's --profile: how often each instruction
+// runs, and how long each rung takes; see profile.c.
+//-----------------------------------------------------------------------------
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <time.h>
+
+#include "ldpi.h"
+
+struct Profile {
+    // Kept by the profiling interpreter, InterpretProfiled().
+    unsigned long long  count[MAX_OPS];     // executions of each pc
+    unsigned long long  ticks[MAX_OPS];     // ProfileTicks() in each rung
+
+    // Worked out from the program by ProfileInit(): the pcs at which a
+    // rung starts, and the rung that each pc belongs to.
+    BYTE                rungStart[MAX_OPS];
+    WORD                rungOf[MAX_OPS];
+    WORD                rungPc[MAX_OPS];    // the first pc of each rung
+    int                 rungs;
+    int                 ops;
+};
+
+extern int Profiling;       // set by --profile
+
+// The cheapest clock there is: the CPU's cycle counter on x86, the generic
+// timer's counter on 64-bit ARM, or else CLOCK_MONOTONIC. ProfileReport()
+// converts it to time.
+static inline unsigned long long ProfileTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    unsigned long long v;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// Find the task's rungs and give it a Profile, after it is loaded.
+void ProfileInit(Task *t);
+
+// Print the task's profile: its rungs, its opcodes and then its program,
+// each with the hottest first.
+void ProfileReport(const Task *t);
+
+#endif
@@ -0,0 +1,273 @@
+//-----------------------------------------------------------------------------
+// The PWM outputs for ldpi. A SET PWM instruction in the ladder only records
+// the duty cycle that it wants, in its task's pwm[], which is copied out at
+// the end of the scan into PwmImage[] like the outputs are into the output
+// image; the task that does the I/O then writes it to the hardware. Writing
+// a PWM channel through sysfs is a few system calls, and the ladder sets
+// the same duty cycle scan after scan, so only a duty cycle that has
+// actually changed is written. Use it with
+//
+//      --pwm=sysfs[:pwmchip0][,freq=HZ]
+//      --pwm=file:PATH[,freq=HZ]
+//
+// The first drives /sys/class/pwm/pwmchip0/pwmN (or chip/pwmN, if chip is
+// a whole path) for PWMN; on the Pi, with dtoverlay=pwm-2chan, PWM0 is on
+// GPIO18 and PWM1 on GPIO19. The second is for testing without one, and
+// rewrites PATH, which can be in /dev/shm, with the duty cycle of every
+// channel (channel 0 first) each time one changes.
+//
+// A channel is named in the ladder by giving the SET PWM's duty cycle
+// variable a name with PWMn in it, for n from 0 to 3: PWM0, or fan_PWM1.
+// The duty cycle is in percent, 0 to 100, as LDmicro has it. The frequency
+// is the one that the SET PWM was given in LDmicro, if the program carries
+// it (in name2), and otherwise freq=HZ, or 1000 Hz.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "pwm.h"
+
+#define PWM_SYSFS               1
+#define PWM_FILE                2
+
+SWORD PwmImage[MAX_PWM];
+int Pwm;
+int PwmUsed;
+long PwmFrequency[MAX_PWM];
+unsigned long long PwmWrites, PwmSuppressed;
+
+static char Path[128];
+static long DefaultFrequency = 1000;
+static const char *Owner[MAX_PWM];
+static int Fd[MAX_PWM] = { -1, -1, -1, -1 };
+static int FileFd = -1;
+static long long Period[MAX_PWM];       // ns
+static SWORD Written[MAX_PWM];
+static int Known;                       // bit n set once PWMn is written
+static int Failing;                     // bit n set while PWMn's writes fail
+
+void PwmConfigure(const char *args)
+{
+    char buf[160], *p, *colon;
+
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+        if(strncmp(p, "freq=", 5) == 0) {
+            DefaultFrequency = atol(p + 5);
+            if(DefaultFrequency <= 0) {
+                fprintf(stderr, "pwm: bad frequency '%s'\n", p + 5);
+                exit(-1);
+            }
+        } else if(!Pwm) {
+            if((colon = strchr(p, ':'))) *colon++ = '\0';
+            if(strcmp(p, "sysfs") == 0) {
+                Pwm = PWM_SYSFS;
+                snprintf(Path, sizeof(Path), "%s%s",
+                    colon && *colon == '/' ? "" : "/sys/class/pwm/",
+                    colon ? colon : "pwmchip0");
+            } else if(strcmp(p, "file") == 0 && colon && *colon) {
+                Pwm = PWM_FILE;
+                snprintf(Path, sizeof(Path), "%s", colon);
+            } else {
+                fprintf(stderr, "pwm: '%s'? (sysfs[:chip] or file:path)\n", p);
+                exit(-1);
+            }
+        }
+    }
+    if(!Pwm) {
+        fprintf(stderr, "pwm: which outputs? (sysfs or file:path)\n");
+        exit(-1);
+    }
+}
+
+int PwmChannelOf(const char *name)
+{
+    const char *p;
+    int channel;
+
+    for(p = name; (p = strstr(p, "PWM")); p++) {
+        if(p[3] >= '0' && p[3] <= '9' && (channel = atoi(p + 3)) < MAX_PWM) {
+            return channel;
+        }
+    }
+    return -1;
+}
+
+void PwmUse(Task *t, int channel, long hz)
+{
+    if(Owner[channel] && Owner[channel] != t->fileName) {
+        fprintf(stderr, "PWM%d is set by both %s and %s\n", channel,
+            Owner[channel], t->fileName);
+        exit(-1);
+    }
+    if(hz && PwmFrequency[channel] && PwmFrequency[channel] != hz) {
+        fprintf(stderr, "%s: PWM%d is set at both %ld and %ld Hz\n",
+            t->fileName, channel, PwmFrequency[channel], hz);
+        exit(-1);
+    }
+    Owner[channel] = t->fileName;
+    if(hz) PwmFrequency[channel] = hz;
+    t->pwmUsed |= 1 << channel;
+    PwmUsed |= 1 << channel;
+}
+
+//-----------------------------------------------------------------------------
+// The sysfs PWM interface: export the channel, then set its period, its
+// duty cycle and enable it, each by writing a number to a file.
+//-----------------------------------------------------------------------------
+static int WriteNumber(int fd, long long n)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%lld\n", n);
+
+    return pwrite(fd, buf, len, 0) == len ? 0 : -1;
+}
+
+static int WriteFile(const char *name, long long n)
+{
+    int fd, ok;
+
+    if((fd = open(name, O_WRONLY)) < 0) return -1;
+    ok = WriteNumber(fd, n);
+    close(fd);
+    return ok;
+}
+
+static void SysfsInit(int channel)
+{
+    char name[192];
+    int tries;
+
+    snprintf(name, sizeof(name), "%s/pwm%d/enable", Path, channel);
+    if(access(name, F_OK) != 0) {
+        snprintf(name, sizeof(name), "%s/export", Path);
+        if(WriteFile(name, channel) < 0 && errno != EBUSY) {
+            perror(name);
+            exit(-1);
+        }
+    }
+
+    // udev may take a moment to make the new files writable.
+    snprintf(name, sizeof(name), "%s/pwm%d/period", Path, channel);
+    for(tries = 0; WriteFile(name, Period[channel]) < 0; tries++) {
+        if(tries >= 20) {
+            perror(name);
+            exit(-1);
+        }
+        usleep(50*1000);
+    }
+    snprintf(name, sizeof(name), "%s/pwm%d/duty_cycle", Path, channel);
+    if((Fd[channel] = open(name, O_WRONLY)) < 0 ||
+        WriteNumber(Fd[channel], 0) < 0)
+    {
+        perror(name);
+        exit(-1);
+    }
+    snprintf(name, sizeof(name), "%s/pwm%d/enable", Path, channel);
+    if(WriteFile(name, 1) < 0) {
+        perror(name);
+        exit(-1);
+    }
+}
+
+static void FileWrite(const SWORD *duty)
+{
+    char buf[64];
+    int i, len = 0;
+
+    for(i = 0; i < MAX_PWM; i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%d", i ? " " : "",
+            duty[i]);
+    }
+    buf[len++] = '\n';
+    // Overwrite, then cut off the rest, so that a reader never finds it
+    // empty.
+    if(pwrite(FileFd, buf, len, 0) != len || ftruncate(FileFd, len) < 0) {
+        LogPrintf("pwm: couldn't write %s: %s\n", Path, strerror(errno));
+    }
+}
+
+void PwmInit(void)
+{
+    int channel;
+
+    if(!PwmUsed) return;
+    if(!Pwm) {
+        printf("the ladder sets PWM channels, but no --pwm was given\n");
+        return;
+    }
+    if(Pwm == PWM_FILE &&
+        (FileFd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        perror(Path);
+        exit(-1);
+    }
+    for(channel = 0; channel < MAX_PWM; channel++) {
+        if(!(PwmUsed & (1 << channel))) continue;
+        if(!PwmFrequency[channel]) PwmFrequency[channel] = DefaultFrequency;
+        Period[channel] = 1000000000LL / PwmFrequency[channel];
+        if(Pwm == PWM_SYSFS) SysfsInit(channel);
+        printf("PWM%d at %ld Hz on %s\n", channel, PwmFrequency[channel], Path);
+    }
+    if(Pwm == PWM_FILE) FileWrite(Written);
+}
+
+void PwmWriteOutputs(const SWORD *duty)
+{
+    int channel, changed = 0;
+    SWORD d;
+
+    if(!Pwm) return;
+    for(channel = 0; channel < MAX_PWM; channel++) {
+        if(!(PwmUsed & (1 << channel))) continue;
+        d = duty[channel];
+        if((Known & (1 << channel)) && d == Written[channel]) {
+            PwmSuppressed++;
+            continue;
+        }
+        if(Pwm == PWM_SYSFS &&
+            WriteNumber(Fd[channel], Period[channel]*d/100) < 0)
+        {
+            // Tried again every scan, but only logged the first time.
+            if(!(Failing & (1 << channel))) {
+                LogPrintf("pwm: couldn't set PWM%d: %s\n", channel,
+                    strerror(errno));
+            }
+            Failing |= 1 << channel;
+            continue;
+        }
+        if(Failing & (1 << channel)) {
+            LogPrintf("pwm: PWM%d set again\n", channel);
+            Failing &= ~(1 << channel);
+        }
+        Written[channel] = d;
+        Known |= 1 << channel;
+        PwmWrites++;
+        changed = 1;
+    }
+    if(changed && Pwm == PWM_FILE) FileWrite(Written);
+}
+
+void PwmStop(void)
+{
+    static const SWORD off[MAX_PWM];
+    char name[192];
+    int channel;
+
+    if(!Pwm || !PwmUsed) return;
+    PwmWriteOutputs(off);
+    for(channel = 0; channel < MAX_PWM; channel++) {
+        if(Fd[channel] < 0) continue;
+        close(Fd[channel]);
+        snprintf(name, sizeof(name), "%s/pwm%d/enable", Path, channel);
+        WriteFile(name, 0);
+    }
+    if(FileFd >= 0) close(FileFd);
+}
@@ -0,0 +1,38 @@
+//-----------------------------------------------------------------------------
+// The PWM outputs for ldpi's SET PWM instructions; see pwm.c.
+//-----------------------------------------------------------------------------
+#ifndef __PWM_H
+#define __PWM_H
+
+#include "ldpi.h"
+
+// The duty cycle of each channel, in percent (0 to 100; SET PWM clamps
+// it), as the tasks last left it: part of the process image, under
+// ImageLock.
+extern SWORD PwmImage[MAX_PWM];
+
+extern int Pwm;                     // nonzero once --pwm was given
+extern int PwmUsed;                 // bit n set if a ladder sets PWMn
+extern long PwmFrequency[MAX_PWM];  // Hz
+extern unsigned long long PwmWrites, PwmSuppressed;
+
+void PwmConfigure(const char *args);
+
+// The channel that a SET PWM's duty cycle variable drives, from a PWMn in
+// its name, or -1.
+int PwmChannelOf(const char *name);
+
+// Note that task t sets the channel, at hz (or the default, if zero).
+void PwmUse(Task *t, int channel, long hz);
+
+// Set up the channels, with their outputs at 0%.
+void PwmInit(void);
+
+// Write the duty cycles of the channels that have changed since the last
+// call; from the task that does the I/O, without ImageLock.
+void PwmWriteOutputs(const SWORD *duty);
+
+// Turn the channels off at exit.
+void PwmStop(void);
+
+#endif
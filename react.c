@@ -0,0 +1,113 @@
+//-----------------------------------------------------------------------------
+// Reaction-time mode for ldpi. Scanning only on the period means that an
+// input edge waits up to a whole cycle before the ladder sees it. With
+// --react the task that does the I/O also waits (in epoll) on edge events
+// from the I/O backend, and an edge starts a scan straight away, as long as
+// it is at least ReactGap after the last one.
+//
+// The ladder's timers count scans, so an extra scan would make them run
+// fast. Instead, a scan started by an edge is the next periodic scan, run
+// early, and the scan after it waits for its own deadline as usual:
+//
+//      periodic:   |  scan(k)          |  scan(k+1)        |  scan(k+2)
+//      edge:       |  scan(k)    ^ scan(k+1)               |  scan(k+2)
+//                  ^ kP          edge  ^ (k+1)P            ^ (k+2)P
+//
+// So a scan is never more than one period early, the count of scans keeps
+// step with the clock, and at most one edge per period is answered early;
+// a second one in the same period is picked up at the next deadline.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "ldpi.h"
+#include "io.h"
+#include "react.h"
+
+int React;
+long long ReactGap = 100000;
+unsigned long ReactScans;
+
+static int Epoll = -1, Timer = -1;
+
+void ReactInit(int priority)
+{
+    struct epoll_event ev;
+    int fds[8], n, i;
+
+    n = IoEventFds(priority, fds);
+    Epoll = epoll_create1(EPOLL_CLOEXEC);
+    Timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(Epoll < 0 || Timer < 0) {
+        perror("--react");
+        exit(-1);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = Timer;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Timer, &ev);
+    // Edge-triggered, since the events themselves are only read (and so
+    // cleared) by the backend when the scan reads the inputs.
+    ev.events = EPOLLIN | EPOLLET;
+    for(i = 0; i < n; i++) {
+        ev.data.fd = fds[i];
+        if(epoll_ctl(Epoll, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            perror("--react");
+            exit(-1);
+        }
+    }
+}
+
+static int Before(const struct timespec *a, const struct timespec *b)
+{
+    return TimespecDiffNs(a, b) < 0;
+}
+
+void ReactWait(const struct timespec *next, const struct timespec *last,
+    long long period, struct timespec *release)
+{
+    struct itimerspec its;
+    struct epoll_event ev[8];
+    struct timespec target = *next, earliest, gap;
+    unsigned long long ticks;
+    int n, i, edge;
+
+    memset(&its, 0, sizeof(its));
+    for(;;) {
+        its.it_value = target;
+        timerfd_settime(Timer, TFD_TIMER_ABSTIME, &its, NULL);
+
+        n = epoll_wait(Epoll, ev, 8, -1);
+        edge = 0;
+        for(i = 0; i < n; i++) {
+            if(ev[i].data.fd != Timer) {
+                edge = 1;
+                continue;
+            }
+            if(read(Timer, &ticks, sizeof(ticks)) != sizeof(ticks)) ticks = 0;
+            *release = target;
+            if(Before(&target, next)) ReactScans++;
+            return;
+        }
+        if(!edge) continue;
+
+        // An edge: the next scan may start now, if that is no earlier than
+        // the previous deadline and no sooner than ReactGap after the last
+        // scan. The backend collects the edge itself when the scan reads
+        // the inputs.
+        clock_gettime(CLOCK_MONOTONIC, &earliest);
+        gap = *last;
+        TimespecAddNs(&gap, ReactGap);
+        if(Before(&earliest, &gap)) earliest = gap;
+        gap = *next;
+        TimespecAddNs(&gap, -period);
+        if(Before(&earliest, &gap)) earliest = gap;
+        if(Before(&earliest, &target)) target = earliest;
+    }
+}
@@ -0,0 +1,23 @@
+//-----------------------------------------------------------------------------
+// Reaction-time mode for ldpi; see react.c.
+//-----------------------------------------------------------------------------
+#ifndef __REACT_H
+#define __REACT_H
+
+#include <time.h>
+
+extern int React;               // nonzero for --react
+extern long long ReactGap;      // shortest time from one scan to the next, ns
+extern unsigned long ReactScans;    // scans started early by an input edge
+
+// Set up the epoll loop on the I/O backend's edge events and a timer.
+// priority is that of the task that does the I/O.
+void ReactInit(int priority);
+
+// Wait for the scan whose periodic deadline is next, and which follows a
+// scan that started at last: until next, or until an input edge, whichever
+// allows a scan first. Sets release to the time the scan was due.
+void ReactWait(const struct timespec *next, const struct timespec *last,
+    long long period, struct timespec *release);
+
+#endif
@@ -0,0 +1,370 @@
+//-----------------------------------------------------------------------------
+// Retentive variables for ldpi. A PLC's counters, accumulated totals and
+// latched states are expected to survive a restart, and a power cut; with
+//
+//      --retain=FILE[,every=N][,only=NAME:NAME...]
+//
+// every task's variables (or, with only=, just the ones named) are kept in
+// FILE, and set from it at startup, before the first scan.
+//
+// The scan's part of this is one memcpy(): every N scans (100 by default)
+// each task copies its Integers[] and Bits[], which lie next to each other
+// in the Task, into the back buffer of a triple buffer of its own, and
+// swaps it for the middle one, as the --pipeline I/O thread does with the
+// pins. A thread of its own, at ordinary priority, looks at the middle
+// buffers ten times a second, and if the retained variables in any of them
+// differ from what is in the file, it writes the file again: all of it, to
+// FILE.tmp, which it fsync()s and then rename()s over FILE, and then
+// fsync()s the directory. A rename is atomic, so whenever the power goes
+// FILE holds one whole snapshot, never half of one; and an unchanging
+// ladder doesn't write the SD card at all. What was written is at most N
+// scans and a tenth of a second older than the ladder. The file is written
+// one last time at exit.
+//
+// The file is text, a line for each variable, under a line naming the
+// task that it belongs to:
+//
+//      task counter.int
+//      Ccount 1234
+//      Rlatched 1
+//
+// so it can be read, or edited while ldpi is stopped; and since variables
+// are found by name, it still applies after the ladder has been changed and
+// compiled again. Names that the ladder no longer has are ignored.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "retain.h"
+
+#define MAX_ONLY                32
+
+// A task's variables, laid out as they are in the Task, so that they can be
+// snapshotted with a single memcpy().
+typedef struct {
+    SWORD       integers[MAX_VARIABLES];
+    BYTE        bits[MAX_INTERNAL_RELAYS];
+} Snapshot;
+
+_Static_assert(offsetof(Task, bits) ==
+    offsetof(Task, integers) + sizeof(((Task *)0)->integers),
+    "a Task's integers[] and bits[] must be contiguous");
+
+#define TB_FRESH                4
+
+typedef struct {
+    Snapshot    buf[3];
+    int         middle;     // index of the shared buffer, | TB_FRESH
+    int         back;       // the scan's buffer
+    int         front;      // the writer's buffer
+    unsigned    scans;      // since the last snapshot
+
+    // The symbols that are kept, and what the file last said for them.
+    WORD        retained[MAX_SYMBOLS];
+    int         retainedCount;
+    SWORD       written[MAX_SYMBOLS];
+} Retained;
+
+const char *RetainFile;
+unsigned long long RetainSnapshots, RetainWrites, RetainUnchanged;
+unsigned long RetainErrors;
+Histogram RetainWriteTime;
+
+static unsigned Every = 100;
+static char Only[MAX_ONLY][MAX_SYMBOL_LEN];
+static int OnlyCount;
+static Retained Retain[MAX_TASKS];
+static int Started;
+static int Dirty;           // written[] is newer than the file
+static int Failing;         // the last write failed, and was logged
+static pthread_t Thread;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Wake = PTHREAD_COND_INITIALIZER;
+
+void RetainConfigure(const char *args)
+{
+    static char file[128];
+    char buf[512], *p, *name, *save;
+
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+        if(strncmp(p, "every=", 6) == 0) {
+            if(atol(p + 6) <= 0) {
+                fprintf(stderr, "retain: bad interval '%s'\n", p + 6);
+                exit(-1);
+            }
+            Every = atol(p + 6);
+        } else if(strncmp(p, "only=", 5) == 0) {
+            for(name = strtok_r(p + 5, ":", &save); name;
+                name = strtok_r(NULL, ":", &save))
+            {
+                if(OnlyCount >= MAX_ONLY) {
+                    fprintf(stderr, "retain: at most %d names\n", MAX_ONLY);
+                    exit(-1);
+                }
+                snprintf(Only[OnlyCount++], MAX_SYMBOL_LEN, "%s", name);
+            }
+        } else if(!RetainFile && *p) {
+            snprintf(file, sizeof(file), "%s", p);
+            RetainFile = file;
+        }
+    }
+    if(!RetainFile) {
+        fprintf(stderr, "retain: which file? (--retain=FILE)\n");
+        exit(-1);
+    }
+}
+
+static const char *TaskName(const Task *t)
+{
+    const char *slash = strrchr(t->fileName, '/');
+
+    return slash ? slash + 1 : t->fileName;
+}
+
+static SWORD ValueOf(const Snapshot *s, const Symbol *sym)
+{
+    return sym->isInt ? s->integers[sym->addr] : s->bits[sym->addr];
+}
+
+//-----------------------------------------------------------------------------
+// The scan's side.
+//-----------------------------------------------------------------------------
+void RetainScan(Task *t)
+{
+    Retained *r = &Retain[t - Tasks];
+
+    if(++r->scans < Every) return;
+    r->scans = 0;
+    memcpy(&r->buf[r->back], t->integers, sizeof(Snapshot));
+    r->back = __atomic_exchange_n(&r->middle, r->back | TB_FRESH,
+        __ATOMIC_ACQ_REL) & ~TB_FRESH;
+}
+
+//-----------------------------------------------------------------------------
+// The file.
+//-----------------------------------------------------------------------------
+
+// Decide which of each task's symbols are kept, and set them from the file.
+void RetainRestore(void)
+{
+    char line[160], name[MAX_SYMBOL_LEN], *dir;
+    Task *t = NULL;
+    Retained *r;
+    FILE *f;
+    int i, k, n, v, restored = 0;
+
+    for(i = 0; i < NumTasks; i++) {
+        r = &Retain[i];
+        r->back = 0;
+        r->middle = 1;
+        r->front = 2;
+        for(k = 0; k < Tasks[i].symbolCount; k++) {
+            if(OnlyCount) {
+                for(n = 0; n < OnlyCount; n++) {
+                    if(strcmp(Only[n], Tasks[i].symbols[k].name) == 0) break;
+                }
+                if(n == OnlyCount) continue;
+            }
+            r->retained[r->retainedCount++] = k;
+        }
+    }
+
+    // Make sure that the file can be written, now rather than at the first
+    // change.
+    snprintf(line, sizeof(line), "%s", RetainFile);
+    dir = dirname(line);
+    if(access(dir, W_OK) < 0) {
+        perror(dir);
+        exit(-1);
+    }
+
+    if(!(f = fopen(RetainFile, "r"))) {
+        if(errno != ENOENT) {
+            perror(RetainFile);
+            exit(-1);
+        }
+        printf("no retained variables in %s yet\n", RetainFile);
+        return;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "task %63s", name) == 1) {
+            for(t = NULL, i = 0; i < NumTasks; i++) {
+                if(strcmp(TaskName(&Tasks[i]), name) == 0) t = &Tasks[i];
+            }
+            continue;
+        }
+        if(!t || sscanf(line, "%63s %d", name, &v) != 2) continue;
+        r = &Retain[t - Tasks];
+        for(k = 0; k < r->retainedCount; k++) {
+            Symbol *sym = &t->symbols[r->retained[k]];
+            if(strcmp(sym->name, name) != 0) continue;
+            if(sym->isInt) {
+                t->integers[sym->addr] = v;
+            } else {
+                t->bits[sym->addr] = v != 0;
+            }
+            restored++;
+        }
+    }
+    fclose(f);
+
+    // The file now matches the tasks; and the other tasks and the outputs
+    // should start from what was restored.
+    for(i = 0; i < NumTasks; i++) {
+        r = &Retain[i];
+        for(k = 0; k < r->retainedCount; k++) {
+            r->written[k] = ValueOf((Snapshot *)Tasks[i].integers,
+                &Tasks[i].symbols[r->retained[k]]);
+        }
+        TaskCopyOut(&Tasks[i]);
+    }
+    printf("%d retained variables restored from %s\n", restored, RetainFile);
+}
+
+static int Write(void)
+{
+    char tmp[160], dir[160];
+    Retained *r;
+    FILE *f;
+    int i, k, fd, ok;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", RetainFile);
+    if(!(f = fopen(tmp, "w"))) return 0;
+    for(i = 0; i < NumTasks; i++) {
+        r = &Retain[i];
+        fprintf(f, "task %s\n", TaskName(&Tasks[i]));
+        for(k = 0; k < r->retainedCount; k++) {
+            fprintf(f, "%s %d\n", Tasks[i].symbols[r->retained[k]].name,
+                r->written[k]);
+        }
+    }
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if(fclose(f) != 0) ok = 0;
+    if(!ok || rename(tmp, RetainFile) < 0) {
+        unlink(tmp);
+        return 0;
+    }
+    // And the rename itself, which is in the directory.
+    snprintf(dir, sizeof(dir), "%s", RetainFile);
+    if((fd = open(dirname(dir), O_RDONLY | O_DIRECTORY)) >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    return 1;
+}
+
+// Look at the newest snapshots, and write the file if any of the retained
+// variables has changed. A failed write (a full card, or one remounted
+// read-only) leaves the file dirty, to be tried again next time, whether
+// or not anything changes in the meantime.
+static void Update(void)
+{
+    struct timespec t0, t1;
+    const Snapshot *s;
+    Retained *r;
+    SWORD v;
+    int i, k, fresh = 0, changed = 0;
+
+    for(i = 0; i < NumTasks; i++) {
+        r = &Retain[i];
+        if(!(__atomic_load_n(&r->middle, __ATOMIC_ACQUIRE) & TB_FRESH)) {
+            continue;
+        }
+        r->front = __atomic_exchange_n(&r->middle, r->front,
+            __ATOMIC_ACQ_REL) & ~TB_FRESH;
+        fresh = 1;
+        s = &r->buf[r->front];
+        for(k = 0; k < r->retainedCount; k++) {
+            v = ValueOf(s, &Tasks[i].symbols[r->retained[k]]);
+            if(v != r->written[k]) {
+                r->written[k] = v;
+                changed = 1;
+            }
+        }
+    }
+    if(fresh) RetainSnapshots++;
+    if(changed) Dirty = 1;
+    if(!Dirty) {
+        if(fresh) RetainUnchanged++;
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(!Write()) {
+        RetainErrors++;
+        if(!Failing) {
+            LogPrintf("retain: %s: %s\n", RetainFile, strerror(errno));
+        }
+        Failing = 1;
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if(Failing) LogPrintf("retain: %s: written again\n", RetainFile);
+    Dirty = Failing = 0;
+    RetainWrites++;
+    HistRecord(&RetainWriteTime, TimespecDiffNs(&t1, &t0));
+}
+
+static void *RetainThread(void *arg)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&Lock);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    while(Running) {
+        TimespecAddNs(&deadline, 100*1000000LL);
+        while(Running && pthread_cond_timedwait(&Wake, &Lock, &deadline)
+            != ETIMEDOUT)
+            ;
+        pthread_mutex_unlock(&Lock);
+        Update();
+        pthread_mutex_lock(&Lock);
+    }
+    pthread_mutex_unlock(&Lock);
+    return NULL;
+}
+
+void RetainStart(void)
+{
+    pthread_attr_t attr;
+    int err;
+
+    if(!RetainFile) return;
+    RtThreadAttr(&attr, 0, -1);
+    if((err = pthread_create(&Thread, &attr, RetainThread, NULL)) != 0) {
+        fprintf(stderr, "couldn't start retain thread: %s\n", strerror(err));
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    Started = 1;
+}
+
+// Once the scans have stopped: snapshot them where they ended, and write
+// that.
+void RetainStop(void)
+{
+    int i;
+
+    if(!Started) return;
+    pthread_mutex_lock(&Lock);
+    pthread_cond_signal(&Wake);
+    pthread_mutex_unlock(&Lock);
+    pthread_join(Thread, NULL);
+    for(i = 0; i < NumTasks; i++) {
+        Retain[i].scans = Every - 1;
+        RetainScan(&Tasks[i]);
+    }
+    Update();
+    Started = 0;
+}
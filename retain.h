@@ -0,0 +1,30 @@
+//-----------------------------------------------------------------------------
+// Retentive state for ldpi: the ladders' variables kept on disk across a
+// restart or a power cut; see retain.c.
+//-----------------------------------------------------------------------------
+#ifndef __RETAIN_H
+#define __RETAIN_H
+
+#include "ldpi.h"
+
+extern const char *RetainFile;      // set by --retain
+extern unsigned long long RetainSnapshots, RetainWrites, RetainUnchanged;
+extern unsigned long RetainErrors;
+extern Histogram RetainWriteTime;
+
+void RetainConfigure(const char *args);
+
+// Set the tasks' variables from the file, if there is one; after the
+// programs are loaded and linked, and before the first scan.
+void RetainRestore(void);
+
+// Start the thread that writes the file, and write it one last time at
+// exit.
+void RetainStart(void);
+void RetainStop(void);
+
+// Called by each task's scan thread at the end of every scan: hand a copy
+// of the task's variables to the writer every so many scans.
+void RetainScan(Task *t);
+
+#endif
@@ -0,0 +1,172 @@
+//-----------------------------------------------------------------------------
+// Real-time support for ldpi; see rt.h.
+//
+// In --realtime mode the scan thread runs under SCHED_FIFO, optionally
+// pinned to one CPU (ideally one reserved with isolcpus=), with all memory
+// locked and prefaulted, so that the only things that can delay a scan are
+// higher-priority real-time threads and interrupts. Anything that wants to
+// print from the scan thread goes through LogPrintf(), which formats into a
+// fixed ring of slots; the main thread drains the ring to stdout.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "rt.h"
+
+int Realtime;
+int RtPriority = 80;
+int RtCpu = -1;
+int BusyPoll;
+
+// How much stack the scan thread gets, and how much of it we prefault.
+#define RT_STACK_SIZE           (256*1024)
+#define RT_PREFAULT_SIZE        (64*1024)
+
+void RtLockMemory(void)
+{
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("mlockall");
+        exit(-1);
+    }
+}
+
+void RtPrefaultStack(void)
+{
+    volatile char stack[RT_PREFAULT_SIZE];
+    memset((char *)stack, 0, sizeof(stack));
+}
+
+void RtThreadAttr(pthread_attr_t *attr, int priority, int cpu)
+{
+    pthread_attr_init(attr);
+    pthread_attr_setstacksize(attr, RT_STACK_SIZE);
+
+    if(priority > 0) {
+        struct sched_param sp;
+
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = priority;
+        pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        pthread_attr_setschedparam(attr, &sp);
+    }
+
+    if(cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+}
+
+// A hint to the CPU that we are in a spin loop: this lets the other hardware
+// thread on the core run, and saves power.
+static inline void CpuRelax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+void SpinUntil(const struct timespec *deadline)
+{
+    struct timespec now;
+
+    for(;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec &&
+            now.tv_nsec >= deadline->tv_nsec))
+        {
+            break;
+        }
+        if(BusyPoll == BUSY_POLL_PAUSE) {
+            CpuRelax();
+        } else if(BusyPoll == BUSY_POLL_YIELD) {
+            sched_yield();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The log queue. This is a bounded multi-producer ring in which every slot
+// carries a sequence number: a producer owns slot (pos % LOG_SLOTS) once it
+// has moved LogHead past pos, and publishes it by setting the slot's
+// sequence to pos+1; the consumer frees it again by setting the sequence to
+// pos+LOG_SLOTS. So producers never wait for each other or for the consumer.
+// The sequence is stored less the slot index, so that the zero-initialized
+// ring is already empty.
+//-----------------------------------------------------------------------------
+#define LOG_SLOTS               256
+#define LOG_LINE                128
+
+typedef struct {
+    unsigned    seq;
+    char        text[LOG_LINE];
+} LogSlot;
+
+static LogSlot LogRing[LOG_SLOTS];
+static unsigned LogHead, LogTail;
+static unsigned long LogDropped;
+
+void LogPrintf(const char *fmt, ...)
+{
+    unsigned pos;
+    LogSlot *s;
+    va_list ap;
+
+    pos = __atomic_load_n(&LogHead, __ATOMIC_RELAXED);
+    for(;;) {
+        int d;
+        s = &LogRing[pos % LOG_SLOTS];
+        d = (int)(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) +
+            pos % LOG_SLOTS - pos);
+        if(d == 0) {
+            if(__atomic_compare_exchange_n(&LogHead, &pos, pos + 1, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        } else if(d < 0) {
+            __atomic_fetch_add(&LogDropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&LogHead, __ATOMIC_RELAXED);
+        }
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(s->text, sizeof(s->text), fmt, ap);
+    va_end(ap);
+
+    __atomic_store_n(&s->seq, pos + 1 - pos % LOG_SLOTS, __ATOMIC_RELEASE);
+}
+
+void LogDrain(void)
+{
+    unsigned long dropped;
+
+    for(;;) {
+        unsigned idx = LogTail % LOG_SLOTS;
+        LogSlot *s = &LogRing[idx];
+        if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != LogTail + 1 - idx) {
+            break;
+        }
+
+        fputs(s->text, stdout);
+        __atomic_store_n(&s->seq, LogTail + LOG_SLOTS - idx, __ATOMIC_RELEASE);
+        LogTail++;
+    }
+
+    dropped = __atomic_exchange_n(&LogDropped, 0, __ATOMIC_RELAXED);
+    if(dropped) printf("(%lu log lines dropped)\n", dropped);
+    fflush(stdout);
+}
@@ -0,0 +1,49 @@
+//-----------------------------------------------------------------------------
+// Real-time support for ldpi: memory locking, scheduling and CPU placement
+// for the scan thread, and a lock-free log queue so that the scan thread
+// never has to call printf() (which can block on the terminal, take locks
+// and allocate) while the ladder is running.
+//-----------------------------------------------------------------------------
+#ifndef __RT_H
+#define __RT_H
+
+#include <pthread.h>
+
+// Real-time settings, filled in from the command line.
+extern int Realtime;            // nonzero for --realtime
+extern int RtPriority;          // SCHED_FIFO priority of the scan thread
+extern int RtCpu;               // CPU to pin the scan thread to, or -1
+
+// How the fastest task waits for its next scan with --busy-poll: by spinning
+// on the clock, with a pause instruction, or with sched_yield(), in the
+// loop. Zero for sleeping in clock_nanosleep().
+#define BUSY_POLL_NONE          1
+#define BUSY_POLL_PAUSE         2
+#define BUSY_POLL_YIELD         3
+extern int BusyPoll;
+
+// Lock all current and future pages of the process into memory; after this
+// the scan thread takes no page faults once its stack has been prefaulted.
+void RtLockMemory(void);
+
+// Touch the top of the calling thread's stack so that it is resident.
+void RtPrefaultStack(void);
+
+// Set up attributes for a thread that runs at the given SCHED_FIFO priority
+// (or the default policy, if the priority is zero) and, if cpu >= 0, is
+// pinned to that CPU.
+void RtThreadAttr(pthread_attr_t *attr, int priority, int cpu);
+
+// Spin until the clock reaches deadline, in the manner given by BusyPoll.
+void SpinUntil(const struct timespec *deadline);
+
+// Queue a line of text for printing by the housekeeping thread. This never
+// blocks; if the queue is full the line is dropped and counted.
+void LogPrintf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+// Print everything queued by LogPrintf(). Called only from the thread that
+// owns stdout.
+void LogDrain(void);
+
+#endif
@@ -0,0 +1,108 @@
+//-----------------------------------------------------------------------------
+// Scan timing statistics for ldpi; see stats.h.
+//
+// The histograms are written by the scan thread and read, without any
+// locking, by whoever prints them, so a report can be off by the scan that
+// was in progress while it was being printed. That is fine for statistics,
+// and it keeps the scan thread from ever waiting on the reader.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+// The smallest value that lands in bucket idx, and the bucket's width.
+static long long BucketLow(int idx)
+{
+    int shift;
+    if(idx < 2*HIST_SUB) return idx;
+    shift = idx/HIST_SUB - 1;
+    return ((long long)(HIST_SUB + idx % HIST_SUB)) << shift;
+}
+
+static long long BucketWidth(int idx)
+{
+    if(idx < 2*HIST_SUB) return 1;
+    return 1LL << (idx/HIST_SUB - 1);
+}
+
+long long HistPercentile(const Histogram *h, double p)
+{
+    unsigned long long want, seen = 0;
+    long long v;
+    int i;
+
+    if(h->count == 0) return 0;
+    want = (unsigned long long)(p*h->count);
+    if(want >= h->count) return h->max;
+
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if(seen > want) break;
+    }
+    if(i >= HIST_BUCKETS) return h->max;
+
+    v = BucketLow(i) + BucketWidth(i)/2;
+    if(v < h->min) v = h->min;
+    if(v > h->max) v = h->max;
+    return v;
+}
+
+double StatsOverhead(void)
+{
+    static Histogram h;
+    struct timespec a, b, t;
+    int i, n = 100000;
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    for(i = 0; i < n; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        HistRecord(&h, t.tv_nsec & 0xffff);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+
+    return ((b.tv_sec - a.tv_sec)*1e9 + (b.tv_nsec - a.tv_nsec)) / n;
+}
+
+static void HistRow(FILE *f, const char *name, const Histogram *h)
+{
+    fprintf(f, "  %-8s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+        h->count, h->min/1e3, HistPercentile(h, 0.5)/1e3,
+        HistPercentile(h, 0.99)/1e3, HistPercentile(h, 0.999)/1e3,
+        h->max/1e3);
+}
+
+void StatsPrint(FILE *f, const char *title, const ScanStats *st)
+{
+    fprintf(f, "%s: %llu scans, %lu overruns\n", title, st->scans,
+        st->overruns);
+    fprintf(f, "  %-8s %10s %9s %9s %9s %9s %9s\n", "(us)", "count", "min",
+        "p50", "p99", "p99.9", "max");
+    HistRow(f, "wake", &st->wake);
+    HistRow(f, "inputs", &st->in);
+    HistRow(f, "logic", &st->logic);
+    HistRow(f, "outputs", &st->out);
+    HistRow(f, "scan", &st->scan);
+    HistRow(f, "span", &st->span);
+    // A period shorter than the longest span would have overrun.
+    fprintf(f, "  shortest stable cycle: %.1f us (%.1f us for 99.9%% of "
+        "scans)\n", st->span.max/1e3, HistPercentile(&st->span, 0.999)/1e3);
+}
+
+void StatsHist(FILE *f, const char *title, const Histogram *h)
+{
+    fprintf(f, "%s:\n", title);
+    fprintf(f, "  %-8s %10s %9s %9s %9s %9s %9s\n", "(us)", "count", "min",
+        "p50", "p99", "p99.9", "max");
+    HistRow(f, "", h);
+}
+
+void StatsLine(FILE *f, const char *title, const ScanStats *st,
+    unsigned long missed)
+{
+    fprintf(f, "%s: scans %llu overruns %lu missed %lu | scan us p50 %.1f "
+        "p99 %.1f max %.1f | wake us p99 %.1f max %.1f\n", title, st->scans,
+        st->overruns, missed, HistPercentile(&st->scan, 0.5)/1e3,
+        HistPercentile(&st->scan, 0.99)/1e3, st->scan.max/1e3,
+        HistPercentile(&st->wake, 0.99)/1e3, st->wake.max/1e3);
+}
@@ -0,0 +1,77 @@
+//-----------------------------------------------------------------------------
+// Scan timing statistics for ldpi. Times are kept in nanoseconds in
+// log-linear histograms (16 linear sub-buckets per power of two, so any
+// reported value is within about 6% of the true one), which are fixed-size
+// and need no allocation, so recording into them from the scan thread costs
+// a few instructions.
+//-----------------------------------------------------------------------------
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdio.h>
+
+#define HIST_SUB_BITS           4
+#define HIST_SUB                (1 << HIST_SUB_BITS)
+// Enough buckets for anything below 2^37 ns (about 137 s); anything bigger
+// than that lands in the last bucket.
+#define HIST_MAX_SHIFT          32
+#define HIST_BUCKETS            ((HIST_MAX_SHIFT + 2) * HIST_SUB)
+
+typedef struct {
+    unsigned long long  count;
+    long long           min;
+    long long           max;
+    unsigned            counts[HIST_BUCKETS];
+} Histogram;
+
+typedef struct {
+    Histogram           wake;       // wake-up time past the deadline
+    Histogram           in;         // getInputs(), and copying the image in
+    Histogram           logic;      // InterpretOneCycle()
+    Histogram           out;        // copying the image out, and setOutputs()
+    Histogram           scan;       // all three together
+    Histogram           span;       // from the deadline to the end of scan
+    unsigned long long  scans;
+    unsigned long       overruns;   // scans that finished past the deadline
+} ScanStats;
+
+static inline void HistRecord(Histogram *h, long long ns)
+{
+    unsigned long long v = ns < 0 ? 0 : ns;
+    int idx;
+
+    if(v < 2*HIST_SUB) {
+        idx = (int)v;
+    } else {
+        int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+        if(shift > HIST_MAX_SHIFT) {
+            idx = HIST_BUCKETS - 1;
+        } else {
+            idx = (shift + 1)*HIST_SUB + (int)(v >> shift) - HIST_SUB;
+        }
+    }
+    h->counts[idx]++;
+
+    if(h->count == 0 || ns < h->min) h->min = ns;
+    if(h->count == 0 || ns > h->max) h->max = ns;
+    h->count++;
+}
+
+// The value below which the fraction p (0..1) of the samples fall.
+long long HistPercentile(const Histogram *h, double p);
+
+// Time how long one timestamp plus one HistRecord() takes, so that the cost
+// of the instrumentation itself is known. Returns nanoseconds.
+double StatsOverhead(void);
+
+// Print a table of all of the histograms in st.
+void StatsPrint(FILE *f, const char *title, const ScanStats *st);
+
+// Print a table of just the one histogram h.
+void StatsHist(FILE *f, const char *title, const Histogram *h);
+
+// Print a one-line summary of st.
+void StatsLine(FILE *f, const char *title, const ScanStats *st,
+    unsigned long missed);
+
+#endif
@@ -0,0 +1,534 @@
+//-----------------------------------------------------------------------------
+// A stream of the changes to ldpi's variables, for clients that want to
+// know when something changes without polling the whole image. With
+// --stream[=PATH], clients connect to a UNIX socket, subscribe to the
+// variables they are interested in, and are sent a compact binary frame
+// for each scan that changed any of them; ldpistream.h has the details.
+//
+// The scan threads do nothing for this beyond publishing the process image
+// (image.c), as they do anyway. The stream has its own thread, at ordinary
+// priority, which reads each task's slot in the image just after each of
+// its scans should have finished, compares it with the last one, eight
+// bytes at a time, and sends each subscriber what changed among the
+// variables it asked for. A subscriber that doesn't keep up has its changes
+// merged until there is room for them, and one that takes nothing at all
+// for STREAM_STALL is disconnected; the thread never waits for a client.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "image.h"
+#include "ldpistream.h"
+#include "stream.h"
+
+#define STREAM_BUFFER           65536   // per subscriber
+#define STREAM_STALL            2000000000LL    // ns
+#define MAX_STREAM_LINE         4096
+
+// A set of Bits[] or Integers[], a bit each.
+#define MASK_WORDS              2
+#if MAX_INTERNAL_RELAYS > 64*MASK_WORDS || MAX_VARIABLES > 64*MASK_WORDS
+#error "MASK_WORDS is too small for MAX_INTERNAL_RELAYS or MAX_VARIABLES"
+#endif
+
+// The biggest frame: every bit and every integer.
+#define FRAME_MAX               (sizeof(LdpiStreamHeader) + \
+                                    2*MAX_INTERNAL_RELAYS + 4*MAX_VARIABLES)
+
+typedef struct {
+    unsigned long long  bits[MASK_WORDS];
+    unsigned long long  ints[MASK_WORDS];
+} Mask;
+
+typedef struct Sub {
+    int         fd;
+    int         count;          // variables subscribed to
+    Mask        wanted[MAX_TASKS];
+    Mask        pending[MAX_TASKS]; // changed, and not sent yet
+    BYTE        carried[MAX_TASKS]; // pending has more than one scan in it
+    WORD        bitIndex[MAX_TASKS][MAX_INTERNAL_RELAYS];
+    WORD        intIndex[MAX_TASKS][MAX_VARIABLES];
+    long long   stalled;        // since when no frame has fitted, or 0
+    unsigned    events;
+    int         len;
+    char        line[MAX_STREAM_LINE];
+    int         txLen, txOff;
+    BYTE        tx[STREAM_BUFFER];
+    struct Sub  *next;
+} Sub;
+
+const char *StreamSocket;
+unsigned long StreamSubscribers;
+unsigned long long StreamFrames, StreamCoalesced, StreamDropped;
+
+static Sub *Subs;
+static int Listener = -1, Epoll = -1, Timer = -1;
+static pthread_t Thread;
+
+// Each task's variables as of the last frames sent, and when to look at
+// its slot in the image again.
+static LdpiImageTask Last[MAX_TASKS];
+static int Watched[MAX_TASKS];
+static long long Due[MAX_TASKS];
+
+void StreamConfigure(const char *path)
+{
+    StreamSocket = path ? path : LDPI_STREAM_DEFAULT;
+}
+
+static long long Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static int Empty(const Mask *m)
+{
+    int w;
+
+    for(w = 0; w < MASK_WORDS; w++) {
+        if(m->bits[w] | m->ints[w]) return 0;
+    }
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Working out what changed, and sending it.
+//-----------------------------------------------------------------------------
+// Set in changed the variables that differ between a and b, comparing
+// eight bytes at a time and only looking closer where those differ.
+static void Diff(const LdpiImageTask *a, const LdpiImageTask *b, Mask *changed)
+{
+    unsigned long long x, y;
+    int w, k;
+
+    memset(changed, 0, sizeof(*changed));
+    for(w = 0; w < MAX_INTERNAL_RELAYS/8; w++) {
+        memcpy(&x, a->bits + 8*w, 8);
+        memcpy(&y, b->bits + 8*w, 8);
+        for(x ^= y; x; x &= x - 1) {
+            k = 8*w + __builtin_ctzll(x)/8;
+            changed->bits[k/64] |= 1ULL << (k % 64);
+        }
+    }
+    for(w = 0; w < MAX_VARIABLES/4; w++) {
+        memcpy(&x, a->integers + 4*w, 8);
+        memcpy(&y, b->integers + 4*w, 8);
+        for(x ^= y; x; x &= x - 1) {
+            k = 4*w + __builtin_ctzll(x)/16;
+            changed->ints[k/64] |= 1ULL << (k % 64);
+        }
+    }
+}
+
+static void Put(BYTE **p, int v)
+{
+    WORD w = v;
+
+    memcpy(*p, &w, 2);
+    *p += 2;
+}
+
+static void Drop(Sub *s)
+{
+    Sub **pp;
+
+    for(pp = &Subs; *pp != s; pp = &(*pp)->next)
+        ;
+    *pp = s->next;
+    close(s->fd);
+    free(s);
+    StreamSubscribers--;
+}
+
+static void Watch(Sub *s, unsigned events)
+{
+    struct epoll_event ev;
+
+    if(events == s->events) return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = s;
+    epoll_ctl(Epoll, EPOLL_CTL_MOD, s->fd, &ev);
+    s->events = events;
+}
+
+// Send what we can; returns -1 if the connection has gone.
+static int Flush(Sub *s)
+{
+    int n;
+
+    while(s->txOff < s->txLen) {
+        n = send(s->fd, s->tx + s->txOff, s->txLen - s->txOff,
+            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno != EAGAIN && errno != EINTR) return -1;
+            break;
+        }
+        s->txOff += n;
+    }
+    memmove(s->tx, s->tx + s->txOff, s->txLen - s->txOff);
+    s->txLen -= s->txOff;
+    s->txOff = 0;
+    Watch(s, EPOLLIN | (s->txLen ? EPOLLOUT : 0));
+    return 0;
+}
+
+// Queue a frame for s of what is pending for task t, if there is room.
+static void Emit(Sub *s, int t, long long now)
+{
+    const LdpiImageTask *v = &Last[t];
+    Mask *m = &s->pending[t];
+    LdpiStreamHeader h;
+    BYTE *p;
+    int w, k;
+
+    if(Empty(m)) return;
+    if(STREAM_BUFFER - s->txLen < (int)FRAME_MAX) {
+        if(!s->stalled) s->stalled = now;
+        s->carried[t] = 1;
+        return;
+    }
+
+    p = s->tx + s->txLen + sizeof(h);
+    memset(&h, 0, sizeof(h));
+    for(w = 0; w < MASK_WORDS; w++) {
+        for(; m->bits[w]; m->bits[w] &= m->bits[w] - 1) {
+            k = 64*w + __builtin_ctzll(m->bits[w]);
+            Put(&p, s->bitIndex[t][k] | (v->bits[k] ? LDPI_STREAM_VALUE : 0));
+            h.count++;
+        }
+        for(; m->ints[w]; m->ints[w] &= m->ints[w] - 1) {
+            k = 64*w + __builtin_ctzll(m->ints[w]);
+            Put(&p, s->intIndex[t][k]);
+            Put(&p, v->integers[k]);
+            h.count++;
+        }
+    }
+    h.size = p - (s->tx + s->txLen);
+    h.task = t;
+    h.cycle = v->cycles;
+    if(s->carried[t]) {
+        h.flags |= LDPI_STREAM_COALESCED;
+        StreamCoalesced++;
+    }
+    memcpy(s->tx + s->txLen, &h, sizeof(h));
+    s->txLen += h.size;
+    s->carried[t] = 0;
+    s->stalled = 0;
+    StreamFrames++;
+}
+
+// Look at each task that is due, and send out what has changed.
+static void Scan(void)
+{
+    static LdpiImageTask snap;
+    long long now = Now(), period;
+    Sub *s, *next;
+    Mask changed;
+    int t, w, skipped;
+
+    for(t = 0; t < NumTasks; t++) {
+        if(!Watched[t] || Due[t] > now) continue;
+        period = Image->tasks[t].cycleTime*1000LL;
+        if(LdpiImageRead(Image, t, &snap) < 0 || snap.cycles == Last[t].cycles) {
+            // Not there yet; look again a little later.
+            Due[t] = now + (period/8 > 20000 ? period/8 : 20000);
+            continue;
+        }
+        Diff(&Last[t], &snap, &changed);
+        skipped = snap.cycles - Last[t].cycles > 1;
+        Last[t] = snap;
+        // Just after the next scan should have finished.
+        Due[t] = snap.scanEnd + period + (period/20 > 20000 ? period/20 : 20000);
+        if(Due[t] <= now) Due[t] = now + period;
+
+        for(s = Subs; s; s = s->next) {
+            for(w = 0; w < MASK_WORDS; w++) {
+                s->pending[t].bits[w] |= changed.bits[w] & s->wanted[t].bits[w];
+                s->pending[t].ints[w] |= changed.ints[w] & s->wanted[t].ints[w];
+            }
+            if(skipped && !Empty(&s->pending[t])) s->carried[t] = 1;
+            Emit(s, t, now);
+        }
+    }
+
+    for(s = Subs; s; s = next) {
+        next = s->next;
+        if(s->stalled && now - s->stalled > STREAM_STALL) {
+            StreamDropped++;
+            Drop(s);
+        } else if(s->txLen && Flush(s) < 0) {
+            Drop(s);
+        }
+    }
+}
+
+static void Arm(void)
+{
+    struct itimerspec its;
+    long long due = 0;
+    int t;
+
+    for(t = 0; t < NumTasks; t++) {
+        if(Watched[t] && (!due || Due[t] < due)) due = Due[t];
+    }
+    memset(&its, 0, sizeof(its));
+    if(due) {
+        its.it_value.tv_sec = due / 1000000000;
+        its.it_value.tv_nsec = due % 1000000000;
+        if(!its.it_value.tv_sec && !its.it_value.tv_nsec) its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(Timer, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Subscribing.
+//-----------------------------------------------------------------------------
+// Returns -1 if there is no room for the reply.
+static int Reply(Sub *s, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf((char *)s->tx + s->txLen, STREAM_BUFFER - s->txLen, fmt, ap);
+    va_end(ap);
+    if(n >= STREAM_BUFFER - s->txLen) return -1;
+    s->txLen += n;
+    return 0;
+}
+
+static int Add(Sub *s, int sym)
+{
+    const LdpiImageSymbol *v = &Image->symbols[sym];
+    unsigned long long *set = v->isInt ? s->wanted[v->task].ints :
+        s->wanted[v->task].bits;
+    WORD *index = v->isInt ? s->intIndex[v->task] : s->bitIndex[v->task];
+    int t = v->task;
+
+    if(!(set[v->addr/64] & (1ULL << (v->addr % 64)))) {
+        set[v->addr/64] |= 1ULL << (v->addr % 64);
+        index[v->addr] = s->count++;
+        (v->isInt ? s->pending[t].ints : s->pending[t].bits)[v->addr/64] |=
+            1ULL << (v->addr % 64);
+    }
+    return Reply(s, "var %d %s%s%s %s\n", index[v->addr], NumTasks > 1 ?
+        Image->tasks[t].fileName : "", NumTasks > 1 ? ":" : "", v->name,
+        v->isInt ? "int" : "bit");
+}
+
+// Returns -1 if the client should be dropped.
+static int Subscribe(Sub *s, char *names)
+{
+    static int syms[MAX_TASKS*MAX_SYMBOLS];
+    char *name, *save;
+    int n = 0, k, t;
+
+    for(name = strtok_r(names, " \t\r", &save); name;
+        name = strtok_r(NULL, " \t\r", &save))
+    {
+        if(strcmp(name, "*") == 0) {
+            for(k = 0; k < (int)Image->symbolCount && n < MAX_TASKS*MAX_SYMBOLS;
+                k++)
+            {
+                syms[n++] = k;
+            }
+        } else if((k = LdpiImageFind(Image, name)) < 0) {
+            return Reply(s, "error: no variable '%s'\n", name);
+        } else if(n < MAX_TASKS*MAX_SYMBOLS) {
+            syms[n++] = k;
+        }
+    }
+    if(!n) return Reply(s, "error: subscribe to what?\n");
+
+    for(k = 0; k < n; k++) {
+        if(Add(s, syms[k]) < 0) return -1;
+    }
+    if(Reply(s, "ok %d\n", s->count) < 0) return -1;
+
+    // The first frame has the current values of the new variables in it.
+    for(t = 0; t < NumTasks; t++) {
+        if(Empty(&s->wanted[t])) continue;
+        if(!Watched[t]) {
+            // Nobody has been watching it, so what we have is out of date.
+            if(LdpiImageRead(Image, t, &Last[t]) < 0) continue;
+            Watched[t] = 1;
+            Due[t] = Now();
+        }
+        Emit(s, t, Now());
+    }
+    return 0;
+}
+
+// Returns -1 once the client has gone, or should go.
+static int Service(Sub *s, unsigned events)
+{
+    char *nl, *line;
+    int n, off;
+
+    if(events & (EPOLLERR | EPOLLHUP)) return -1;
+    if((events & EPOLLOUT) && Flush(s) < 0) return -1;
+    if(!(events & EPOLLIN)) return 0;
+
+    n = recv(s->fd, s->line + s->len, sizeof(s->line) - 1 - s->len, 0);
+    if(n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if(n == 0) return -1;
+    s->len += n;
+    s->line[s->len] = '\0';
+
+    off = 0;
+    while((nl = strchr(s->line + off, '\n'))) {
+        *nl = '\0';
+        line = s->line + off;
+        off = nl + 1 - s->line;
+        // Once the frames have started, a line of text could be mistaken
+        // for one; so anything the client sends after that is ignored.
+        if(s->count) continue;
+        if(strncmp(line, "subscribe", 9) == 0 && (!line[9] || line[9] == ' ')) {
+            if(Subscribe(s, line + 9) < 0) return -1;
+        } else if(Reply(s, "error: unknown command\n") < 0) {
+            return -1;
+        }
+    }
+    if(off == 0 && s->len == sizeof(s->line) - 1) return -1;
+    memmove(s->line, s->line + off, s->len - off);
+    s->len -= off;
+    return Flush(s);
+}
+
+static void Accept(void)
+{
+    struct epoll_event ev;
+    Sub *s;
+    int fd;
+
+    while((fd = accept4(Listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))
+        >= 0)
+    {
+        if(!(s = calloc(1, sizeof(*s)))) {
+            close(fd);
+            continue;
+        }
+        s->fd = fd;
+        s->events = EPOLLIN;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = s->events;
+        ev.data.ptr = s;
+        if(epoll_ctl(Epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(s);
+            continue;
+        }
+        s->next = Subs;
+        Subs = s;
+        StreamSubscribers++;
+    }
+}
+
+// Which tasks anyone still wants to hear about.
+static void Rewatch(void)
+{
+    Sub *s;
+    int t;
+
+    for(t = 0; t < NumTasks; t++) {
+        Watched[t] = 0;
+        for(s = Subs; s && !Watched[t]; s = s->next) {
+            Watched[t] = !Empty(&s->wanted[t]);
+        }
+    }
+}
+
+static void *StreamThread(void *arg)
+{
+    struct epoll_event ev[16];
+    unsigned long long ticks;
+    int i, n, due;
+
+    for(;;) {
+        Arm();
+        n = epoll_wait(Epoll, ev, 16, -1);
+        due = 0;
+        for(i = 0; i < n; i++) {
+            if(ev[i].data.ptr == &Timer) {
+                if(read(Timer, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+                    ticks = 0;
+                }
+                due = 1;
+            } else if(ev[i].data.ptr == NULL) {
+                Accept();
+            } else if(Service(ev[i].data.ptr, ev[i].events) < 0) {
+                Drop(ev[i].data.ptr);
+            }
+        }
+        // After the events, since this may drop subscribers that they are
+        // for.
+        if(due) Scan();
+        Rewatch();
+    }
+    return NULL;
+}
+
+void StreamStart(void)
+{
+    struct sockaddr_un sa;
+    struct epoll_event ev;
+    pthread_attr_t attr;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if(strlen(StreamSocket) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "--stream: path too long\n");
+        exit(-1);
+    }
+    strcpy(sa.sun_path, StreamSocket);
+    unlink(StreamSocket);
+
+    Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(Listener < 0 || bind(Listener, (struct sockaddr *)&sa, sizeof(sa)) < 0
+        || listen(Listener, 16) < 0)
+    {
+        perror(StreamSocket);
+        exit(-1);
+    }
+    Epoll = epoll_create1(EPOLL_CLOEXEC);
+    Timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(Epoll < 0 || Timer < 0) {
+        perror("--stream");
+        exit(-1);
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Listener, &ev);
+    ev.data.ptr = &Timer;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Timer, &ev);
+    printf("Change stream on %s\n", StreamSocket);
+
+    RtThreadAttr(&attr, 0, -1);
+    if(pthread_create(&Thread, &attr, StreamThread, NULL) != 0) {
+        perror("--stream");
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void StreamStop(void)
+{
+    if(Listener >= 0) unlink(StreamSocket);
+}
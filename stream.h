@@ -0,0 +1,17 @@
+//-----------------------------------------------------------------------------
+// The change stream for ldpi's variables; see stream.c.
+//-----------------------------------------------------------------------------
+#ifndef __STREAM_H
+#define __STREAM_H
+
+extern const char *StreamSocket;    // set by --stream
+extern unsigned long StreamSubscribers;
+extern unsigned long long StreamFrames, StreamCoalesced, StreamDropped;
+
+void StreamConfigure(const char *path);
+
+// Start the stream's thread, and remove the socket at exit.
+void StreamStart(void);
+void StreamStop(void);
+
+#endif
@@ -0,0 +1,367 @@
+//-----------------------------------------------------------------------------
+// The serial port for ldpi. LDmicro's UART SEND and UART RECV instructions
+// move one character a scan, and on a microcontroller that is one register
+// access; here the characters go through a pair of ring buffers instead,
+// and an I/O thread of its own, at ordinary priority, does the read()s and
+// write()s on the port, waiting for it in epoll. So the instructions never
+// make a system call, and never wait for the port:
+//
+//      UART SEND   if its bit is set, queue the character, if there is
+//                  room; then its bit is set if there is no room for the
+//                  next one (the 'busy' of LDmicro's UART SEND).
+//      UART RECV   if a character has come in, take it and set its bit;
+//                  otherwise clear its bit.
+//
+// Each ring has one producer and one consumer (only one ladder may use the
+// UART), so they need no locks: each side only ever moves its own index,
+// and publishes it with a release store. Sending to a full ring, or the
+// port delivering more than the RX ring can hold because the ladder isn't
+// taking it, is counted as an overflow. Rather than have the scan wake the
+// I/O thread for each character it sends (a system call, and a context
+// switch), the thread looks for them once a scan of the ladder that uses
+// the UART (but no more often than every millisecond, and no less than
+// every ten), as the stream's thread does for changes; so a character goes
+// out at most about one scan after the ladder sent it. Use it with
+//
+//      --uart=/dev/ttyAMA0[,baud=N]    (9600 by default)
+//      --uart=pty
+//
+// The second makes a pseudo-terminal, and prints the name of the other end
+// of it, for testing with a terminal program or a script.
+//-----------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ldpi.h"
+#include "rt.h"
+#include "uart.h"
+
+#define UART_RING               1024    // a power of two
+
+typedef struct {
+    unsigned    head;           // moved only by the producer
+    unsigned    tail;           // moved only by the consumer
+    BYTE        buf[UART_RING];
+} Ring;
+
+const char *UartDevice;
+int UartUsed;
+unsigned long long UartSent, UartReceived;
+unsigned long long UartTxOverflows, UartRxOverflows;
+unsigned long UartErrors;
+
+static long Baud = 9600;
+static const char *Owner;
+static int PollMs;
+static Ring Tx, Rx;
+static int Fd = -1, Slave = -1, Epoll = -1, Kick = -1;
+static int Started;
+static int Gone;                // the port hung up; see HangUp()
+static struct termios Saved;
+static pthread_t Thread;
+
+static const struct {
+    long        baud;
+    speed_t     speed;
+} Speeds[] = {
+    { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+    { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+    { 921600, B921600 }, { 0, 0 }
+};
+
+void UartConfigure(const char *args)
+{
+    static char device[128];
+    char buf[160], *p;
+
+    strncpy(buf, args, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for(p = strtok(buf, ","); p; p = strtok(NULL, ",")) {
+        if(strncmp(p, "baud=", 5) == 0) {
+            Baud = atol(p + 5);
+        } else if(!UartDevice && *p) {
+            snprintf(device, sizeof(device), "%s", p);
+            UartDevice = device;
+        }
+    }
+    if(!UartDevice) {
+        fprintf(stderr, "uart: which port? (--uart=/dev/ttyXXX or pty)\n");
+        exit(-1);
+    }
+}
+
+void UartUse(Task *t)
+{
+    if(Owner && Owner != t->fileName) {
+        fprintf(stderr, "the UART is used by both %s and %s\n", Owner,
+            t->fileName);
+        exit(-1);
+    }
+    Owner = t->fileName;
+    UartUsed = 1;
+    PollMs = t->cycleTime/1000;
+    if(PollMs < 1) PollMs = 1;
+    if(PollMs > 10) PollMs = 10;
+}
+
+//-----------------------------------------------------------------------------
+// The scan's side: O(1), and no system calls.
+//-----------------------------------------------------------------------------
+int UartSend(BYTE c)
+{
+    unsigned head = Tx.head;
+
+    // Without a port, what is sent just disappears.
+    if(!Started) return 1;
+
+    if(head - __atomic_load_n(&Tx.tail, __ATOMIC_ACQUIRE) >= UART_RING) {
+        UartTxOverflows++;
+        return 0;
+    }
+    Tx.buf[head % UART_RING] = c;
+    __atomic_store_n(&Tx.head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int UartBusy(void)
+{
+    if(!Started) return 0;
+    return Tx.head - __atomic_load_n(&Tx.tail, __ATOMIC_ACQUIRE) >= UART_RING;
+}
+
+int UartRecv(void)
+{
+    unsigned tail = Rx.tail;
+    int c;
+
+    if(tail == __atomic_load_n(&Rx.head, __ATOMIC_ACQUIRE)) return -1;
+    c = Rx.buf[tail % UART_RING];
+    __atomic_store_n(&Rx.tail, tail + 1, __ATOMIC_RELEASE);
+    return c;
+}
+
+//-----------------------------------------------------------------------------
+// The I/O thread's side.
+//-----------------------------------------------------------------------------
+
+// Write as much of Tx as the port will take; returns nonzero if some is
+// left over.
+static int Transmit(void)
+{
+    unsigned head = __atomic_load_n(&Tx.head, __ATOMIC_ACQUIRE);
+    unsigned tail = Tx.tail;
+    int n, len;
+
+    while(tail != head) {
+        len = head - tail;
+        if(len > UART_RING - (int)(tail % UART_RING)) {
+            len = UART_RING - tail % UART_RING;
+        }
+        n = write(Fd, &Tx.buf[tail % UART_RING], len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN) {
+                UartErrors++;
+                LogPrintf("uart: %s: %s\n", UartDevice, strerror(errno));
+                tail = head;        // drop it, rather than retry forever
+            }
+            break;
+        }
+        tail += n;
+        UartSent += n;
+    }
+    __atomic_store_n(&Tx.tail, tail, __ATOMIC_RELEASE);
+    return tail != head;
+}
+
+// The port has gone (a USB adapter unplugged, say), and would only go on
+// reporting that, so stop watching it. What the ladder sends piles up in
+// Tx until UART SEND reports busy.
+static void HangUp(const char *why)
+{
+    UartErrors++;
+    LogPrintf("uart: %s: %s; no longer using it\n", UartDevice, why);
+    epoll_ctl(Epoll, EPOLL_CTL_DEL, Fd, NULL);
+    Gone = 1;
+}
+
+static void Receive(void)
+{
+    unsigned tail = __atomic_load_n(&Rx.tail, __ATOMIC_ACQUIRE);
+    unsigned head = Rx.head;
+    BYTE scratch[256];
+    int n, len;
+
+    for(;;) {
+        len = UART_RING - (head - tail);
+        if(len > UART_RING - (int)(head % UART_RING)) {
+            len = UART_RING - head % UART_RING;
+        }
+        // With the ring full, read into the scratch buffer and drop it, or
+        // the port would stay readable and we would spin.
+        if(len == 0) {
+            n = read(Fd, scratch, sizeof(scratch));
+            if(n > 0) UartRxOverflows += n;
+        } else {
+            n = read(Fd, &Rx.buf[head % UART_RING], len);
+            if(n > 0) {
+                head += n;
+                UartReceived += n;
+                __atomic_store_n(&Rx.head, head, __ATOMIC_RELEASE);
+            }
+        }
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        tail = __atomic_load_n(&Rx.tail, __ATOMIC_ACQUIRE);
+    }
+    if(n == 0) {
+        HangUp("hung up");
+    } else if(n < 0 && errno != EAGAIN) {
+        HangUp(strerror(errno));
+    }
+}
+
+static void *UartThread(void *arg)
+{
+    struct epoll_event ev[4], port;
+    unsigned long long kicks;
+    int i, n, pending, watching = EPOLLIN;
+
+    while(Running) {
+        pending = Gone ? 0 : Transmit();
+        if(!Gone && pending != ((watching & EPOLLOUT) != 0)) {
+            watching = EPOLLIN | (pending ? EPOLLOUT : 0);
+            memset(&port, 0, sizeof(port));
+            port.events = watching;
+            port.data.fd = Fd;
+            epoll_ctl(Epoll, EPOLL_CTL_MOD, Fd, &port);
+        }
+        // With something left over, the port says when it can take more;
+        // otherwise look for more from the ladder in a scan's time.
+        n = epoll_wait(Epoll, ev, 4, pending ? -1 : PollMs);
+        for(i = 0; i < n; i++) {
+            if(ev[i].data.fd == Kick) {
+                if(read(Kick, &kicks, sizeof(kicks)) < 0) kicks = 0;
+            } else if(ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                Receive();
+                if(!Gone && (ev[i].events & (EPOLLERR | EPOLLHUP))) {
+                    HangUp("hung up");
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static void OpenPty(void)
+{
+    struct termios tio;
+
+    if((Fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) < 0 ||
+        grantpt(Fd) < 0 || unlockpt(Fd) < 0)
+    {
+        perror("uart: pty");
+        exit(-1);
+    }
+    // Keep the other end open ourselves, so that the port doesn't hang up
+    // whenever nothing else has it open; and make it raw, since that is
+    // where the pty's line discipline is.
+    if((Slave = open(ptsname(Fd), O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0) {
+        perror(ptsname(Fd));
+        exit(-1);
+    }
+    tcgetattr(Slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(Slave, TCSANOW, &tio);
+    printf("UART on pty %s\n", ptsname(Fd));
+}
+
+static void OpenPort(void)
+{
+    struct termios tio;
+    int i;
+
+    for(i = 0; Speeds[i].baud && Speeds[i].baud != Baud; i++)
+        ;
+    if(!Speeds[i].baud) {
+        fprintf(stderr, "uart: no such baud rate %ld\n", Baud);
+        exit(-1);
+    }
+    if((Fd = open(UartDevice, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC))
+        < 0 || tcgetattr(Fd, &Saved) < 0)
+    {
+        perror(UartDevice);
+        exit(-1);
+    }
+    tio = Saved;
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&tio, Speeds[i].speed);
+    cfsetospeed(&tio, Speeds[i].speed);
+    if(tcsetattr(Fd, TCSANOW, &tio) < 0) {
+        perror(UartDevice);
+        exit(-1);
+    }
+    tcflush(Fd, TCIOFLUSH);
+    printf("UART on %s at %ld baud\n", UartDevice, Baud);
+}
+
+void UartStart(void)
+{
+    struct epoll_event ev;
+    pthread_attr_t attr;
+    int err;
+
+    if(!UartUsed) return;
+    if(!UartDevice) {
+        printf("the ladder uses the UART, but no --uart was given; nothing "
+            "is sent or received\n");
+        return;
+    }
+    if(strcmp(UartDevice, "pty") == 0) OpenPty(); else OpenPort();
+
+    Epoll = epoll_create1(EPOLL_CLOEXEC);
+    Kick = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(Epoll < 0 || Kick < 0) {
+        perror("uart");
+        exit(-1);
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = Fd;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Fd, &ev);
+    ev.data.fd = Kick;
+    epoll_ctl(Epoll, EPOLL_CTL_ADD, Kick, &ev);
+
+    RtThreadAttr(&attr, 0, -1);
+    if((err = pthread_create(&Thread, &attr, UartThread, NULL)) != 0) {
+        fprintf(stderr, "couldn't start UART thread: %s\n", strerror(err));
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    Started = 1;
+}
+
+void UartStop(void)
+{
+    unsigned long long one = 1;
+
+    if(!Started) return;
+    // Wake the thread now to see that Running is clear.
+    if(write(Kick, &one, sizeof(one)) < 0) UartErrors++;
+    pthread_join(Thread, NULL);
+    if(Slave < 0) tcsetattr(Fd, TCSADRAIN, &Saved);
+    close(Fd);
+    if(Slave >= 0) close(Slave);
+    Started = 0;
+}
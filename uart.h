@@ -0,0 +1,33 @@
+//-----------------------------------------------------------------------------
+// The serial port for ldpi's UART SEND and UART RECV instructions; see
+// uart.c.
+//-----------------------------------------------------------------------------
+#ifndef __UART_H
+#define __UART_H
+
+#include "ldpi.h"
+
+extern const char *UartDevice;      // set by --uart
+extern int UartUsed;                // nonzero if a ladder uses the UART
+extern unsigned long long UartSent, UartReceived;
+extern unsigned long long UartTxOverflows, UartRxOverflows;
+extern unsigned long UartErrors;
+
+void UartConfigure(const char *args);
+
+// Note that task t uses the UART; only one of them may.
+void UartUse(Task *t);
+
+// Open the port and start its I/O thread, and stop it at exit.
+void UartStart(void);
+void UartStop(void);
+
+// From the scan: queue c to be sent, returning zero if there is no room;
+// and whether there is room for another.
+int UartSend(BYTE c);
+int UartBusy(void);
+
+// From the scan: the next character received, or -1 if there is none.
+int UartRecv(void);
+
+#endif
@@ -0,0 +1,184 @@
+//-----------------------------------------------------------------------------
+// Virtual-time execution for ldpi. The ladder's timers count scans, so if we
+// advance a simulated clock by one period per scan instead of waiting for
+// the real one, we can run the program as fast as the CPU allows and still
+// get exactly the behaviour it would have had on the real machine. That
+// makes it possible to test days of operation in a few seconds.
+//
+// The tasks are run in order of their next release time on the simulated
+// clock; when two are due at the same moment the faster one (the one with
+// the higher priority) goes first, as it would under the real scheduler.
+//
+// The inputs come from a stimulus file, with one change per line:
+//
+//      # seconds   input   value
+//      0.0         GPI0    1
+//      2.5         GPI0    0
+//      3.0         ADC2    512
+//
+// in order of time. An input is named as the ladder names it (GPIn), or by
+// its name in the --map file; an ADCn line sets what the ladder's READ ADC
+// of channel n reads from then on. Every change of an output, or of the
+// duty cycle of a PWMn, is written to the record file in the same format,
+// stamped with the simulated time of the scan that wrote it.
+//
+// The stimuli go straight into the ladder's side of the input image, and
+// the outputs are recorded from its side of the output image, so the I/O
+// layer's active-low inversion and debounce filter, and any forces on the
+// pins, play no part in a virtual run.
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ldpi.h"
+#include "io.h"
+#include "adc.h"
+#include "pwm.h"
+#include "profile.h"
+
+const char *StimulusFile;
+const char *RecordFile;
+
+typedef struct {
+    long long   when;       // ns of simulated time
+    int         pin;        // or the ADC channel
+    BYTE        adc;
+    SWORD       value;
+} Stimulus;
+
+static Stimulus *Stimuli;
+static int StimulusCount;
+
+static void LoadStimulus(const char *fileName)
+{
+    char line[128], name[32];
+    int max = 0, n = 0, value;
+    double when;
+    FILE *f;
+
+    if(!fileName) return;
+    if(!(f = fopen(fileName, "r"))) {
+        fprintf(stderr, "couldn't open '%s'\n", fileName);
+        exit(-1);
+    }
+    while(fgets(line, sizeof(line), f)) {
+        Stimulus *s;
+        int pin, output = 0, adc = 0;
+
+        n++;
+        if(line[strspn(line, " \t\r\n")] == '#') continue;
+        if(line[strspn(line, " \t\r\n")] == '\0') continue;
+        if(sscanf(line, "%lf %31s %d", &when, name, &value) != 3) {
+            pin = -1;
+        } else if(sscanf(name, "ADC%d", &pin) == 1) {
+            adc = 1;
+        } else if((pin = IoPinOf(name, &output)) >= 0 && output) {
+            pin = -1;
+        }
+        if(pin < 0 || pin >= (adc ? ADC_CHANNELS : MAX_PINS)) {
+            fprintf(stderr, "%s:%d: bad stimulus\n", fileName, n);
+            exit(-1);
+        }
+
+        if(StimulusCount >= max) {
+            max = max ? max*2 : 64;
+            Stimuli = realloc(Stimuli, max*sizeof(Stimulus));
+            if(!Stimuli) {
+                fprintf(stderr, "out of memory\n");
+                exit(-1);
+            }
+        }
+        s = &Stimuli[StimulusCount++];
+        s->when = (long long)(when*1e9 + 0.5);
+        s->pin = pin;
+        s->adc = adc;
+        s->value = adc ? value : (value ? 1 : 0);
+        if(StimulusCount > 1 && s->when < s[-1].when) {
+            fprintf(stderr, "%s:%d: stimulus out of order\n", fileName, n);
+            exit(-1);
+        }
+    }
+    fclose(f);
+}
+
+void RunVirtual(double seconds)
+{
+    long long next[MAX_TASKS], now = 0, end = (long long)(seconds*1e9);
+    unsigned long long scans = 0;
+    IoWord recorded[IO_WORDS];
+    SWORD recordedPwm[MAX_PWM];
+    struct timespec a, b;
+    FILE *rec = NULL;
+    int i, pin, s = 0, first = 1;
+    double wall;
+
+    LoadStimulus(StimulusFile);
+    if(RecordFile && !(rec = fopen(RecordFile, "w"))) {
+        fprintf(stderr, "couldn't create '%s'\n", RecordFile);
+        exit(-1);
+    }
+    if(rec) fprintf(rec, "# seconds   output  value\n");
+
+    for(i = 0; i < NumTasks; i++) next[i] = 0;
+    memset(recorded, 0, sizeof(recorded));
+    memset(recordedPwm, 0, sizeof(recordedPwm));
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    while(Running) {
+        Task *t;
+        int k = 0;
+
+        for(i = 1; i < NumTasks; i++) {
+            if(next[i] < next[k]) k = i;
+        }
+        now = next[k];
+        if(now >= end) break;
+        t = &Tasks[k];
+
+        if(t->io) {
+            for(; s < StimulusCount && Stimuli[s].when <= now; s++) {
+                if(Stimuli[s].adc) {
+                    AdcValues[Stimuli[s].pin] = Stimuli[s].value;
+                } else {
+                    IO_SET(InputImage, Stimuli[s].pin, Stimuli[s].value);
+                }
+            }
+        }
+        TaskCopyIn(t);
+        if(Profiling) InterpretProfiled(t); else InterpretOneCycle(t);
+        TaskCopyOut(t);
+        if(t->io && rec) {
+            for(pin = 0; pin < MAX_PINS; pin++) {
+                int v = IO_GET(OutputImage, pin);
+                if(!IO_GET(OutputPins, pin)) continue;
+                if(!first && IO_GET(recorded, pin) == v) continue;
+                IO_SET(recorded, pin, v);
+                fprintf(rec, "%.6f GPO%d %d\n", now/1e9, pin, v);
+            }
+            first = 0;
+        }
+        for(i = 0; rec && i < MAX_PWM; i++) {
+            if(!(t->pwmUsed & (1 << i))) continue;
+            if(recordedPwm[i] == PwmImage[i]) continue;
+            recordedPwm[i] = PwmImage[i];
+            fprintf(rec, "%.6f PWM%d %d\n", now/1e9, i, PwmImage[i]);
+        }
+
+        t->stats.scans++;
+        next[k] += t->cycleTime*1000LL;
+        scans++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    if(rec) fclose(rec);
+
+    wall = TimespecDiffNs(&b, &a)/1e9;
+    printf("Simulated %.3f s in %.3f s (%.0fx real time)\n", now/1e9, wall,
+        wall > 0 ? now/1e9/wall : 0);
+    for(i = 0; i < NumTasks; i++) {
+        printf("%s: %llu scans\n", Tasks[i].fileName, Tasks[i].stats.scans);
+    }
+    printf("%.0f simulated cycles per second\n", wall > 0 ? scans/wall : 0);
+    for(i = 0; Profiling && i < NumTasks; i++) ProfileReport(&Tasks[i]);
+}